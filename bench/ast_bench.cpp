@@ -0,0 +1,178 @@
+// Pointer AST against the flat, index-based one.
+//
+// Usage: ast_bench [file.lox | size-in-MB]
+//
+// Parses a script (by default a generated, expression-heavy one), lowers it
+// to a FlatAst and reports the footprint of both forms along with the time it
+// takes to visit every node of each. The flat form is then serialised, read
+// back, inflated and lowered again, and must come out byte-for-byte the same.
+
+#include "Arena.hpp"
+#include "FlatAst.hpp"
+#include "Parser.hpp"
+#include "Scanner.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace {
+
+std::string generate(size_t bytes) {
+  std::string src;
+  src.reserve(bytes + 256);
+  for (int i = 0; src.size() < bytes; i++) {
+    src += fmt::format("fun step_{}(a, b) {{\n", i);
+    src += fmt::format("  var t = (a * {} + b) / (a - {}.5) * 2;\n", i % 89,
+                       i % 13);
+    src += "  if (t >= 10 and !(a == b) or t < -3) {\n"
+           "    a = a + 1; b = b * 2 - a;\n  } else {\n"
+           "    while (a < 5) { a = a + 1; }\n  }\n";
+    src += fmt::format("  print(t > {} ? \"big\" : \"small\");\n}}\n", i % 7);
+  }
+  return src;
+}
+
+// Sums every number literal, which means touching every node
+struct PointerWalk
+    : lox::expr::Visitor<void>
+    , lox::stmt::Visitor<void> {
+  double sum = 0.;
+
+  void walk(lox::ExprPtr e) {
+    if (e) { e->accept(*this); }
+  }
+  void walk(lox::StmtPtr s) {
+    if (s) { s->accept(*this); }
+  }
+  void walk(lox::StatementsList stmts) {
+    for (auto s : stmts) { walk(s); }
+  }
+
+  void visitAssignExpr(lox::Assign &a) override { walk(a.val_); }
+  void visitBinaryExpr(lox::Binary &b) override {
+    walk(b.left_);
+    walk(b.right_);
+  }
+  void visitTernaryExpr(lox::Ternary &t) override {
+    walk(t.cond_);
+    walk(t.left_);
+    walk(t.right_);
+  }
+  void visitCallExpr(lox::Call &c) override {
+    walk(c.callee_);
+    for (auto arg : c.args_) { walk(arg); }
+  }
+  void visitGroupExpr(lox::Group &g) override { walk(g.expr_); }
+  void visitBoolLiteralExpr(lox::BoolLiteral &) override {}
+  void visitStrLiteralExpr(lox::StrLiteral &) override {}
+  void visitNullLiteralExpr(lox::NullLiteral &) override {}
+  void visitNumLiteralExpr(lox::NumLiteral &n) override { sum += n.value_; }
+  void visitLogicalExpr(lox::Logical &l) override {
+    walk(l.left_);
+    walk(l.right_);
+  }
+  void visitVariableExpr(lox::Variable &) override {}
+  void visitUnaryExpr(lox::Unary &u) override { walk(u.right_); }
+
+  void visitBlockStmt(lox::Block &b) override { walk(b.statements_); }
+  void visitExpressionStmt(lox::Expression &e) override {
+    walk(e.expression_);
+  }
+  void visitFnStmt(lox::Fn &f) override { walk(f.statements_); }
+  void visitIfStmt(lox::If &i) override {
+    walk(i.condition_);
+    walk(i.then_);
+    walk(i.else_br_);
+  }
+  void visitWhileStmt(lox::While &w) override {
+    walk(w.condition_);
+    walk(w.body_);
+    walk(w.increment_);
+  }
+  void visitVarStmt(lox::Var &v) override { walk(v.initialiser_); }
+  void visitReturnStmt(lox::Return &r) override { walk(r.value_); }
+  void visitBreakStmt(lox::Break &) override {}
+  void visitContinueStmt(lox::Continue &) override {}
+};
+
+double flat_walk(const lox::FlatAst &ast) {
+  double sum = 0.;
+  for (auto &node : ast.exprs()) {
+    if (node.kind == lox::flat::ExprKind::NUM) { sum += ast.number(node.a); }
+  }
+  return sum;
+}
+
+template <typename F>
+double best_of(int repeats, F &&f) {
+  double best = 1e300;
+  for (int i = 0; i < repeats; i++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, secs.count());
+  }
+  return best * 1000.;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string src;
+  if (argc > 1 && std::ifstream(argv[1])) {
+    std::ifstream f(argv[1], std::ios::in | std::ios::binary);
+    src.assign(std::istreambuf_iterator<char>(f), {});
+  } else {
+    size_t mb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+    src       = generate(mb * 1024 * 1024);
+  }
+
+  lox::Arena arena;
+  lox::Scanner scanner(src);
+  auto tree = lox::Parser(scanner, arena).parse();
+  auto flat = lox::FlatAst::lower(tree);
+
+  fmt::print("source: {:.1f} MB, {} expression and {} statement nodes\n",
+             src.size() / (1024. * 1024.), flat.exprs().size(),
+             flat.stmts().size());
+  fmt::print("pointer AST: {:6.1f} MB\n", arena.bytes_used() / (1024. * 1024.));
+  fmt::print("flat AST:    {:6.1f} MB\n",
+             flat.memory_usage() / (1024. * 1024.));
+
+  double pointer_sum = 0., flat_sum = 0.;
+  auto pointer_ms = best_of(5, [&] {
+    PointerWalk walk;
+    walk.walk(tree);
+    pointer_sum = walk.sum;
+  });
+  auto flat_ms = best_of(5, [&] { flat_sum = flat_walk(flat); });
+  fmt::print("walk, pointer: {:8.2f} ms\n", pointer_ms);
+  fmt::print("walk, flat:    {:8.2f} ms ({:.1f}x)\n", flat_ms,
+             pointer_ms / flat_ms);
+  if (pointer_sum != flat_sum) {
+    fmt::print("the two walks disagree!\n");
+    return 1;
+  }
+
+  auto bytes  = flat.serialise();
+  auto loaded = lox::FlatAst::deserialise(bytes);
+  if (!loaded) {
+    fmt::print("serialised AST was rejected!\n");
+    return 1;
+  }
+  lox::Arena again;
+  auto round_trip = lox::FlatAst::lower(loaded->inflate(again)).serialise();
+  fmt::print("serialised:  {:6.1f} MB\n", bytes.size() / (1024. * 1024.));
+  if (round_trip != bytes) {
+    fmt::print("AST changed on its way through the flat form!\n");
+    return 1;
+  }
+  return 0;
+}
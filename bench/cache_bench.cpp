@@ -0,0 +1,119 @@
+// Cold against warm start with the compiled-script cache.
+//
+// Usage: cache_bench [file.lox | size-in-MB]
+//
+// A cold start scans, parses and optimises the script, then lowers it and
+// writes it to the cache; a warm one maps the cached entry and inflates it
+// straight back into an AST. Both use a scratch cache directory which is
+// removed afterwards. The tree a warm start produces must lower to the very
+// same bytes as the one the cold start parsed.
+
+#include "Arena.hpp"
+#include "FlatAst.hpp"
+#include "Optimiser.hpp"
+#include "Parser.hpp"
+#include "Scanner.hpp"
+#include "ScriptCache.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <unistd.h>
+
+namespace {
+
+std::string generate(size_t bytes) {
+  std::string src;
+  src.reserve(bytes + 256);
+  for (int i = 0; src.size() < bytes; i++) {
+    src += fmt::format("fun step_{}(a, b) {{\n", i);
+    src += fmt::format("  var t = (a * {} + b) / (a - {}.5) * 2;\n", i % 89,
+                       i % 13);
+    src += "  if (t >= 10 and !(a == b) or t < -3) {\n"
+           "    a = a + 1; b = b * 2 - a;\n  } else {\n"
+           "    while (a < 5) { a = a + 1; }\n  }\n";
+    src += fmt::format("  print(t > {} ? \"big\" : \"small\");\n}}\n", i % 7);
+  }
+  return src;
+}
+
+template <typename F>
+double best_of(int repeats, F &&f) {
+  double best = 1e300;
+  for (int i = 0; i < repeats; i++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, secs.count());
+  }
+  return best * 1000.;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string src;
+  if (argc > 1 && std::ifstream(argv[1])) {
+    std::ifstream f(argv[1], std::ios::in | std::ios::binary);
+    src.assign(std::istreambuf_iterator<char>(f), {});
+  } else {
+    size_t mb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4;
+    src       = generate(mb * 1024 * 1024);
+  }
+
+  auto dir = std::filesystem::temp_directory_path() /
+             fmt::format("cache_bench.{}", ::getpid());
+  lox::ScriptCache cache(dir.string());
+
+  std::string cold_bytes;
+  auto cold_ms = best_of(5, [&] {
+    lox::Arena arena;
+    lox::Scanner scanner(src);
+    auto tree  = lox::Parser(scanner, arena).parse();
+    tree       = lox::Optimiser(arena).optimise(tree);
+    auto flat  = lox::FlatAst::lower(tree);
+    cold_bytes = flat.serialise();
+    if (auto err = cache.store(src, 1, flat)) {
+      fmt::print("couldn't write the cache: {}\n", err.message());
+      std::exit(1);
+    }
+  });
+
+  std::string warm_bytes;
+  bool hit     = true;
+  auto warm_ms = best_of(5, [&] {
+    lox::Arena arena;
+    auto flat = cache.load(src, 1);
+    if (!flat) {
+      hit = false;
+      return;
+    }
+    auto tree = flat->inflate(arena);
+    // Only for the comparison below; a real warm start stops at inflate
+    if (warm_bytes.empty()) {
+      warm_bytes = lox::FlatAst::lower(tree).serialise();
+    }
+  });
+  std::filesystem::remove_all(dir);
+
+  fmt::print("source: {:.1f} MB\n", src.size() / (1024. * 1024.));
+  fmt::print("cold start: {:8.2f} ms\n", cold_ms);
+  if (!hit) {
+    fmt::print("the cached script wasn't found again!\n");
+    return 1;
+  }
+  fmt::print("warm start: {:8.2f} ms ({:.1f}x)\n", warm_ms, cold_ms / warm_ms);
+  if (warm_bytes != cold_bytes) {
+    fmt::print("the cached AST differs from the parsed one!\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,133 @@
+// Re-parsing a whole script against an incremental Document edit.
+//
+// Usage: edit_bench [file.lox | size-in-MB] [edits]
+//
+// Parses a script (by default a generated one) from scratch, then makes a
+// run of small random edits to it through a Document: typing and deleting
+// single characters, and now and then a quote or a brace that disturbs much
+// more of the text. Once done, the document's tree and errors must be the
+// same as those of a fresh parse of the edited text.
+
+#include "Arena.hpp"
+#include "Document.hpp"
+#include "Error.hpp"
+#include "FlatAst.hpp"
+#include "Parser.hpp"
+#include "Scanner.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <utility>
+
+namespace {
+
+std::string generate(size_t bytes) {
+  std::string src;
+  src.reserve(bytes + 256);
+  for (int i = 0; src.size() < bytes; i++) {
+    src += fmt::format("fun step_{}(a, b) {{\n", i);
+    src += fmt::format("  var t = (a * {} + b) / (a - {}.5) * 2;\n", i % 89,
+                       i % 13);
+    src += "  if (t >= 10 and !(a == b) or t < -3) {\n"
+           "    a = a + 1; b = b * 2 - a;\n  } else {\n"
+           "    while (a < 5) { a = a + 1; }\n  }\n";
+    src += fmt::format("  print(t > {} ? \"big\" : \"small\");\n}}\n", i % 7);
+  }
+  return src;
+}
+
+double since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+  return secs.count() * 1000.;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string src;
+  if (argc > 1 && std::ifstream(argv[1])) {
+    std::ifstream f(argv[1], std::ios::in | std::ios::binary);
+    src.assign(std::istreambuf_iterator<char>(f), {});
+  } else {
+    size_t mb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4;
+    src       = generate(mb * 1024 * 1024);
+  }
+  int edits = argc > 2 ? std::atoi(argv[2]) : 2000;
+
+  auto start = std::chrono::steady_clock::now();
+  lox::Document doc(src);
+  auto full_ms = since(start);
+
+  // Lines only move with newlines, and reused declarations keep the lines
+  // they were scanned at, so leave newlines alone to compare trees exactly
+  std::mt19937 rng(42);
+  // Typing, then quotes and braces, which can throw off everything after
+  struct Stats {
+    int edits       = 0;
+    double total_ms = 0., worst_ms = 0.;
+    size_t parsed   = 0;
+  } typing, unbalanced;
+  for (int i = 0; i < edits; i++) {
+    auto offset = std::uniform_int_distribution<size_t>(0, src.size())(rng);
+    auto kind   = rng() % 16;
+    auto &stats = kind < 14 ? typing : unbalanced;
+    size_t removed = 0;
+    std::string inserted;
+    if (kind < 7 && offset < src.size() && src[offset] != '\n') {
+      removed = 1;
+    } else if (kind < 14) {
+      inserted = std::string(1, "abxy019+-*;() "[rng() % 14]);
+    } else {
+      inserted = kind == 14 ? "\"" : "{";
+    }
+    src.replace(offset, removed, inserted);
+
+    start       = std::chrono::steady_clock::now();
+    auto change = doc.edit(offset, removed, inserted);
+    auto ms     = since(start);
+    stats.edits++;
+    stats.total_ms += ms;
+    stats.worst_ms = std::max(stats.worst_ms, ms);
+    stats.parsed += change.added;
+  }
+
+  fmt::print("source: {:.1f} MB, {} declarations\n",
+             src.size() / (1024. * 1024.), doc.declarations().size());
+  fmt::print("full parse: {:9.3f} ms\n", full_ms);
+  for (auto [name, stats] : {std::pair{"typing", typing},
+                             std::pair{"quotes and braces", unbalanced}}) {
+    if (!stats.edits) { continue; }
+    fmt::print("{} ({} edits): mean {:.3f} ms, worst {:.3f} ms, {:.1f} "
+               "declarations parsed per edit\n",
+               name, stats.edits, stats.total_ms / stats.edits,
+               stats.worst_ms,
+               static_cast<double>(stats.parsed) / stats.edits);
+  }
+
+  if (doc.text() != src) {
+    fmt::print("the document's text went wrong!\n");
+    return 1;
+  }
+  lox::ErrorCollector collector;
+  lox::Arena arena;
+  lox::Scanner scanner(src);
+  auto fresh = lox::FlatAst::lower(lox::Parser(scanner, arena).parse());
+  auto fresh_errors = collector.take().size();
+  if (lox::FlatAst::lower(doc.statements()).serialise() != fresh.serialise()) {
+    fmt::print("the edited tree differs from a fresh parse!\n");
+    return 1;
+  }
+  if (doc.errors().size() != fresh_errors) {
+    fmt::print("{} errors after editing, {} from a fresh parse!\n",
+               doc.errors().size(), fresh_errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,230 @@
+// Checks incremental Document edits against parsing from scratch.
+//
+// Usage: edit_check [seed] [scripts] [edits]
+//
+// Makes runs of random edits to small generated scripts, newlines, quotes
+// and braces included. After every edit, the document's text, tokens, tree
+// and errors must be those of a fresh parse of the edited text, with each
+// token's locate() giving where a fresh scan finds it. Prints the seed, so
+// a failing run can be repeated.
+
+#include "Arena.hpp"
+#include "Document.hpp"
+#include "Error.hpp"
+#include "FlatAst.hpp"
+#include "Parser.hpp"
+#include "Scanner.hpp"
+#include "Token.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using lox::FlatAst;
+using lox::flat::ExprKind;
+using lox::flat::Index;
+using lox::flat::StmtKind;
+
+const char *const fragments[] = {
+    "a", "b1", " ", "\n", ";", "(", ")", "{", "}", "\"", "//", "+", "*", "=",
+    "!", "?", ":", ",", "0.5", "var x = 1;\n", "fun f(a) {\n", "return a;\n",
+    "if (a) ", "else ", "while (b) ", "print(\"s\");\n", "break;", "}\n",
+};
+
+std::string generate(std::mt19937 &rng) {
+  std::string src;
+  auto decls = 1 + rng() % 24;
+  for (unsigned i = 0; i < decls; i++) {
+    switch (rng() % 4) {
+    case 0:
+      src += fmt::format("var v{} = {} * (a - \"s{}\");\n", i, i, i);
+      break;
+    case 1:
+      src += fmt::format("fun f{}(a, b) {{\n  // comment {}\n"
+                         "  if (a < b) {{ return a; }} else {{ b = b + 1; }}"
+                         "\n  while (a) {{ a = !a or b; }}\n}}\n",
+                         i, i);
+      break;
+    case 2:
+      src += fmt::format("print(f{}(1, 2) ? {} : nil);\n\n", i, i);
+      break;
+    default: src += fmt::format("{{ var t = {}; t = t >= 2; }}\n", i); break;
+    }
+  }
+  return src;
+}
+
+// The trees must match in everything but the lines names were found on,
+// which reused declarations keep from when they were scanned
+bool same_tree(const FlatAst &a, const FlatAst &b) {
+  auto same_name = [&](Index x, Index y) {
+    return a.string(a.name(x).string) == b.string(b.name(y).string);
+  };
+  auto same_names = [&](Index x, Index y) {
+    auto xs = a.list(x), ys = b.list(y);
+    if (xs.size() != ys.size()) { return false; }
+    for (size_t i = 0; i < xs.size(); i++) {
+      if (!same_name(xs[i], ys[i])) { return false; }
+    }
+    return true;
+  };
+  auto same_list = [&](Index x, Index y) {
+    auto xs = a.list(x), ys = b.list(y);
+    return std::equal(xs.begin(), xs.end(), ys.begin(), ys.end());
+  };
+
+  if (a.exprs().size() != b.exprs().size() ||
+      a.stmts().size() != b.stmts().size() ||
+      !std::equal(a.roots().begin(), a.roots().end(), b.roots().begin(),
+                  b.roots().end())) {
+    return false;
+  }
+  for (size_t i = 0; i < a.exprs().size(); i++) {
+    auto &x = a.exprs()[i];
+    auto &y = b.exprs()[i];
+    if (x.kind != y.kind || x.op != y.op) { return false; }
+    switch (x.kind) {
+    case ExprKind::ASSIGN:
+      if (!same_name(x.a, y.a) || x.b != y.b) { return false; }
+      break;
+    case ExprKind::VARIABLE:
+      if (!same_name(x.a, y.a)) { return false; }
+      break;
+    case ExprKind::STR:
+      if (a.string(x.a) != b.string(y.a)) { return false; }
+      break;
+    case ExprKind::NUM:
+      if (a.number(x.a) != b.number(y.a)) { return false; }
+      break;
+    case ExprKind::CALL:
+      if (x.a != y.a || !same_list(x.b, y.b)) { return false; }
+      break;
+    default:
+      if (x.a != y.a || x.b != y.b || x.c != y.c) { return false; }
+      break;
+    }
+  }
+  for (size_t i = 0; i < a.stmts().size(); i++) {
+    auto &x = a.stmts()[i];
+    auto &y = b.stmts()[i];
+    if (x.kind != y.kind) { return false; }
+    switch (x.kind) {
+    case StmtKind::BLOCK:
+      if (!same_list(x.a, y.a)) { return false; }
+      break;
+    case StmtKind::FN:
+      if (!same_name(x.a, y.a) || !same_names(x.b, y.b) ||
+          !same_list(x.c, y.c)) {
+        return false;
+      }
+      break;
+    case StmtKind::VAR:
+      if (!same_name(x.a, y.a) || x.b != y.b) { return false; }
+      break;
+    default:
+      if (x.a != y.a || x.b != y.b || x.c != y.c) { return false; }
+      break;
+    }
+  }
+  return true;
+}
+
+// What's wrong with the document, or nothing if it matches a fresh parse
+std::string check(const lox::Document &doc, const std::string &src) {
+  if (doc.text() != src) { return "text"; }
+
+  lox::ErrorCollector collector;
+  std::vector<lox::Token> tokens;
+  lox::Scanner scanner(src);
+  for (auto tok = scanner.next_token(); tok.type() != lox::TokenType::EOF;
+       tok = scanner.next_token()) {
+    tokens.push_back(tok);
+  }
+  collector.take();
+
+  size_t at = 0;
+  for (auto &decl : doc.declarations()) {
+    for (auto &tok : decl.tokens) {
+      if (at == tokens.size()) { return "too many tokens"; }
+      auto &fresh = tokens[at++];
+      auto loc    = decl.locate(tok);
+      auto want   = fresh.location();
+      if (tok.type() != fresh.type() || tok.lexeme() != fresh.lexeme()) {
+        return fmt::format("token {}", at - 1);
+      }
+      if (loc.line_ != want.line_ || loc.chr_ != want.chr_ ||
+          loc.end_chr_ != want.end_chr_) {
+        return fmt::format("line {} at {} located on line {} at {}",
+                           want.line_, want.chr_, loc.line_, loc.chr_);
+      }
+    }
+  }
+  if (at != tokens.size()) { return "too few tokens"; }
+
+  lox::Arena arena;
+  lox::Scanner reparse(src);
+  auto tree   = FlatAst::lower(lox::Parser(reparse, arena).parse());
+  auto errors = collector.take();
+  if (!same_tree(FlatAst::lower(doc.statements()), tree)) { return "tree"; }
+
+  // A fresh parse reports lexical errors as it scans ahead, where the
+  // document files them with the declaration they were found in
+  auto messages = [](const std::vector<lox::Diagnostic> &diagnostics) {
+    std::vector<std::string> messages;
+    for (auto &d : diagnostics) { messages.push_back(d.message); }
+    std::sort(messages.begin(), messages.end());
+    return messages;
+  };
+  auto got = messages(doc.errors()), want = messages(errors);
+  auto [g, w] = std::mismatch(got.begin(), got.end(), want.begin(),
+                              want.end());
+  if (g != got.end() || w != want.end()) {
+    return fmt::format("error \"{}\", not \"{}\",",
+                       g != got.end() ? *g : "", w != want.end() ? *w : "");
+  }
+  return "";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  auto seed   = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                         : std::random_device{}();
+  int scripts = argc > 2 ? std::atoi(argv[2]) : 200;
+  int edits   = argc > 3 ? std::atoi(argv[3]) : 200;
+  fmt::print("seed {}\n", seed);
+
+  std::mt19937 rng(seed);
+  for (int s = 0; s < scripts; s++) {
+    auto src = generate(rng);
+    lox::Document doc(src);
+    for (int e = 0; e < edits; e++) {
+      auto offset  = std::uniform_int_distribution<size_t>(0, src.size())(rng);
+      auto removed = std::uniform_int_distribution<size_t>(
+          0, std::min<size_t>(src.size() - offset, rng() % 3 ? 2 : 12))(rng);
+      std::string inserted;
+      for (auto n = rng() % 3; n > 0; n--) {
+        inserted += fragments[rng() % std::size(fragments)];
+      }
+      src.replace(offset, removed, inserted);
+      doc.edit(offset, removed, inserted);
+
+      auto wrong = check(doc, src);
+      if (!wrong.empty()) {
+        fmt::print("script {}, edit {} (replacing {} bytes at {} with "
+                   "\"{}\"): {} differs from a fresh parse\n",
+                   s, e, removed, offset, inserted, wrong);
+        return 1;
+      }
+    }
+  }
+  fmt::print("{} scripts, {} edits each: ok\n", scripts, edits);
+  return 0;
+}
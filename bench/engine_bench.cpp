@@ -0,0 +1,125 @@
+// The tree-walking interpreter against the bytecode VM.
+//
+// Usage: engine_bench
+//
+// Each program is parsed and optimised once, then run start to finish by a
+// fresh Interpreter and a fresh VM, and both must leave the same value in the
+// global `result`. Built with LOX_JIT, a VM running machine code joins them.
+
+#include "Arena.hpp"
+#include "Interpreter.hpp"
+#include "Optimiser.hpp"
+#include "Parser.hpp"
+#include "Scanner.hpp"
+#include "Utils.hpp"
+#include "VM.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+namespace {
+
+struct Program {
+  const char *name;
+  const char *source;
+};
+
+constexpr Program programs[] = {
+    {"loop",
+     "var i = 0; var result = 0;\n"
+     "while (i < 2000000) { result = result + i * 2; i = i + 1; }\n"},
+    {"locals",
+     "fun sum(n) {\n"
+     "  var i = 0; var s = 0;\n"
+     "  while (i < n) { var sq = i * i; s = s + sq / 2; i = i + 1; }\n"
+     "  result = s;\n"
+     "}\n"
+     "var result; sum(2000000);\n"},
+    {"numbers",
+     "fun poly(n) {\n"
+     "  var i = 0; var s = 0; var a = 1.5; var b = 2.5;\n"
+     "  while (i < n) {\n"
+     "    s = s + a * b - i * a + b * i * a - a / b + i * i - b * 3;\n"
+     "    i = i + 1;\n"
+     "  }\n"
+     "  result = s;\n"
+     "}\n"
+     "var result; poly(500000);\n"},
+    {"calls",
+     "fun fib(n) {\n"
+     "  if (n < 2) { result = result + 1; } else { fib(n - 1); fib(n - 2); }\n"
+     "}\n"
+     "var result = 0; fib(24);\n"},
+    {"returns",
+     "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+     "var result = fib(24);\n"},
+    {"tail",
+     "fun count(n, acc) {\n"
+     "  if (n == 0) return acc;\n"
+     "  return count(n - 1, acc + 1);\n"
+     "}\n"
+     "var result = count(500000, 0);\n"},
+    {"strings",
+     "var i = 0; var result = \"\";\n"
+     "while (i < 20000) { result = result + \"ab\"; i = i + 1; }\n"},
+};
+
+template <typename F>
+double best_of(int repeats, F &&f) {
+  double best = 1e300;
+  for (int i = 0; i < repeats; i++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, secs.count());
+  }
+  return best * 1000.;
+}
+
+template <typename Engine, typename... EngineArgs>
+std::string run(lox::StatementsList tree, EngineArgs... args) {
+  Engine engine(args...);
+  engine.interpret(tree);
+  auto &result = engine.globals()[engine.globals().slot("result")];
+  return result ? lox::to_string(*result) : "undefined";
+}
+
+} // namespace
+
+int main() {
+  int failed = 0;
+  for (auto &program : programs) {
+    lox::Arena arena;
+    lox::Scanner scanner(program.source);
+    auto tree = lox::Parser(scanner, arena).parse();
+    tree      = lox::Optimiser(arena).optimise(tree);
+
+    std::string tree_result, vm_result;
+    auto tree_ms =
+        best_of(3, [&] { tree_result = run<lox::Interpreter>(tree); });
+    auto vm_ms = best_of(3, [&] { vm_result = run<lox::VM>(tree); });
+    fmt::print("{:<8} tree-walker {:8.2f} ms   vm {:8.2f} ms ({:.1f}x)\n",
+               program.name, tree_ms, vm_ms, tree_ms / vm_ms);
+    if (tree_result != vm_result) {
+      fmt::print("  results differ: {} against {}\n", tree_result, vm_result);
+      failed++;
+    }
+#if LOX_JIT
+    std::string jit_result;
+    auto jit_ms = best_of(3, [&] {
+      jit_result = run<lox::VM>(tree, /*tail_calls=*/true, /*jit=*/true);
+    });
+    fmt::print("{:34}jit {:8.2f} ms ({:.1f}x)\n", "", jit_ms,
+               tree_ms / jit_ms);
+    if (tree_result != jit_result) {
+      fmt::print("  results differ: {} against {}\n", tree_result, jit_result);
+      failed++;
+    }
+#endif
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+// Scanner throughput in MB/s.
+//
+// Usage: scanner_bench [file.lox | size-in-MB]
+//
+// With no file a synthetic program is generated that looks roughly like our
+// machine-generated scripts: indented bodies, comments, long identifiers and
+// plenty of numbers. The footprint of the full token vector is also compared
+// against the packed TokenBuffer, and the parallel tokeniser is timed and
+// checked against the sequential one.
+
+#include "ParallelScanner.hpp"
+#include "Scanner.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::string generate(size_t bytes) {
+  std::string src;
+  src.reserve(bytes + 256);
+  for (int i = 0; src.size() < bytes; i++) {
+    src += fmt::format("// generated block {} with some commentary text\n", i);
+    src += fmt::format("fun configure_section_{}(first_argument, second) {{\n",
+                       i);
+    src += fmt::format("    var threshold_value_{} = {}.{} * first_argument;\n",
+                       i, i * 7919 % 100000, i % 97);
+    src += "    if (threshold_value_" + std::to_string(i) +
+           " >= 1024) {\n        print(\"over the limit\");\n    }\n";
+    src += "    second = second + 1234567;   // trailing comment\n}\n\n";
+  }
+  return src;
+}
+
+double scan_mbps(const std::string &src, int repeats,
+                 std::vector<lox::Token> &out) {
+  double best = 0.;
+  for (int i = 0; i < repeats; i++) {
+    auto start = std::chrono::steady_clock::now();
+    lox::Scanner scanner(src);
+    auto tokens = scanner.tokenise();
+    std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+    best = std::max(best, src.size() / secs.count() / (1024. * 1024.));
+    if (i == repeats - 1) { out = std::move(tokens); }
+  }
+  return best;
+}
+
+bool same_token(const lox::Token &l, const lox::Token &r) {
+  return l.type() == r.type() && l.lexeme() == r.lexeme() &&
+         l.line() == r.line() && l.offset() == r.offset();
+}
+
+bool same(const lox::TokenBuffer &a, const lox::TokenBuffer &b) {
+  if (a.size() != b.size()) { return false; }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (!same_token(a[i], b[i])) { return false; }
+  }
+  return true;
+}
+
+bool same(const std::vector<lox::Token> &a, const lox::TokenBuffer &b) {
+  if (a.size() != b.size()) { return false; }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (!same_token(a[i], b[i])) { return false; }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string src;
+  if (argc > 1 && std::ifstream(argv[1])) {
+    std::ifstream f(argv[1], std::ios::in | std::ios::binary);
+    src.assign(std::istreambuf_iterator<char>(f), {});
+  } else {
+    size_t mb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 32;
+    src       = generate(mb * 1024 * 1024);
+  }
+
+  std::vector<lox::Token> tokens;
+  auto mbps = scan_mbps(src, 5, tokens);
+
+  fmt::print("source: {:.1f} MB, {} tokens\n", src.size() / (1024. * 1024.),
+             tokens.size());
+  fmt::print("scanner: {:8.1f} MB/s\n", mbps);
+
+  lox::Scanner scanner(src);
+  auto compact = scanner.tokenise_compact();
+  fmt::print("std::vector<Token>: {:6.1f} MB ({} bytes/token)\n",
+             tokens.capacity() * sizeof(lox::Token) / (1024. * 1024.),
+             sizeof(lox::Token));
+  fmt::print("TokenBuffer:        {:6.1f} MB\n",
+             compact.memory_usage() / (1024. * 1024.));
+  if (!same(tokens, compact)) {
+    fmt::print("TokenBuffer disagrees with the token vector!\n");
+    return 1;
+  }
+
+  auto threads = std::max(1u, std::thread::hardware_concurrency());
+  for (auto n : {1u, 2u, 4u, threads}) {
+    if (n > 1 && n > threads) { continue; }
+    double best = 0.;
+    lox::TokenBuffer parallel(src);
+    for (int i = 0; i < 5; i++) {
+      auto start = std::chrono::steady_clock::now();
+      parallel   = lox::tokenise_parallel(src, n);
+      std::chrono::duration<double> secs =
+          std::chrono::steady_clock::now() - start;
+      best = std::max(best, src.size() / secs.count() / (1024. * 1024.));
+    }
+    fmt::print("parallel, {:2} threads: {:8.1f} MB/s\n", n, best);
+    if (!same(compact, parallel)) {
+      fmt::print("parallel tokeniser disagrees with the sequential one!\n");
+      return 1;
+    }
+    if (n == threads) { break; }
+  }
+  return 0;
+}
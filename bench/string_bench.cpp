@@ -0,0 +1,81 @@
+// Building a big string a piece at a time, the way report-generating scripts
+// do, in both the tree-walker and the VM.
+//
+// Usage: string_bench [size-in-MB]
+//
+// The script appends a 50-character line to a string until it reaches the
+// size asked for (10 MB by default). Either engine must end up with exactly
+// that many characters.
+
+#include "Arena.hpp"
+#include "Interpreter.hpp"
+#include "Parser.hpp"
+#include "Scanner.hpp"
+#include "VM.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+template <typename F>
+double best_of(int repeats, F &&f) {
+  double best = 1e300;
+  for (int i = 0; i < repeats; i++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, secs.count());
+  }
+  return best * 1000.;
+}
+
+// Length of the string the script built, or 0 if it didn't
+template <typename Engine>
+size_t run(lox::StatementsList tree) {
+  Engine engine;
+  engine.interpret(tree);
+  auto &report = engine.globals()[engine.globals().slot("report")];
+  return report && report->is_string() ? report->as_string().text().size()
+                                       : 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t mb    = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10;
+  size_t lines = mb * 1024 * 1024 / 50;
+  auto src = fmt::format(
+      "var report = \"\";\n"
+      "var i = 0;\n"
+      "while (i < {}) {{\n"
+      "  report = report + \"{:-<50}\";\n"
+      "  i = i + 1;\n"
+      "}}\n",
+      lines, "one line of the report, padded out ");
+
+  lox::Arena arena;
+  lox::Scanner scanner(src);
+  auto tree = lox::Parser(scanner, arena).parse();
+
+  int failed = 0;
+  auto report = [&](const char *engine, double ms, size_t size) {
+    fmt::print("{:<12} {:8.2f} ms  {:7.1f} MB/s\n", engine, ms,
+               size / (1024. * 1024.) / (ms / 1000.));
+    if (size != lines * 50) {
+      fmt::print("  built {} characters, not {}\n", size, lines * 50);
+      failed++;
+    }
+  };
+  size_t size = 0;
+  auto ms     = best_of(3, [&] { size = run<lox::Interpreter>(tree); });
+  report("tree-walker", ms, size);
+  ms = best_of(3, [&] { size = run<lox::VM>(tree); });
+  report("vm", ms, size);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+#include "Arena.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace lox {
+
+Arena &Arena::operator=(Arena &&other) noexcept {
+  if (this == &other) { return *this; }
+  release();
+  head_ = std::exchange(other.head_, nullptr);
+  cur_  = std::exchange(other.cur_, nullptr);
+  end_  = std::exchange(other.end_, nullptr);
+  used_ = std::exchange(other.used_, 0);
+  return *this;
+}
+
+// Blocks double in size up to a limit, so even a very large program only
+// ends up with a few dozen of them
+void *Arena::allocate_slow(size_t size, size_t align) {
+  auto next = head_ ? std::min(head_->size * 2, max_block_) : first_block_;
+  auto need = sizeof(Block) + size + align;
+  next      = std::max(next, need);
+
+  auto block = static_cast<Block *>(std::malloc(next));
+  if (!block) { throw std::bad_alloc(); }
+  block->prev = head_;
+  block->size = next;
+  head_       = block;
+  cur_        = reinterpret_cast<char *>(block + 1);
+  end_        = reinterpret_cast<char *>(block) + next;
+  return allocate(size, align);
+}
+
+void Arena::release() {
+  while (head_) { std::free(std::exchange(head_, head_->prev)); }
+  cur_  = nullptr;
+  end_  = nullptr;
+  used_ = 0;
+}
+
+} // namespace lox
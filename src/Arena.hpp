@@ -0,0 +1,91 @@
+#ifndef LOX_ARENA_HPP
+#define LOX_ARENA_HPP
+
+#include <absl/strings/string_view.h>
+#include <absl/types/span.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace lox {
+
+// Bump allocator owning every AST node of a compilation. Nodes are handed out
+// as plain pointers and are never destroyed one by one: when the arena goes,
+// its blocks are freed and that is the end of it. Anything allocated here
+// must therefore be trivially destructible, which make() checks.
+class Arena {
+  struct Block {
+    Block *prev;
+    size_t size;
+  };
+
+  static constexpr size_t first_block_ = 16 * 1024;
+  static constexpr size_t max_block_   = 1024 * 1024;
+
+  Block *head_ = nullptr;
+  char *cur_   = nullptr;
+  char *end_   = nullptr;
+  size_t used_ = 0;
+
+  void *allocate_slow(size_t size, size_t align);
+  void release();
+
+ public:
+  Arena() = default;
+  Arena(Arena &&other) noexcept { *this = std::move(other); }
+  Arena &operator=(Arena &&) noexcept;
+  Arena(const Arena &)            = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena() { release(); }
+
+  void *allocate(size_t size, size_t align) {
+    auto p = (reinterpret_cast<uintptr_t>(cur_) + align - 1) & ~(align - 1);
+    if (!cur_ || p + size > reinterpret_cast<uintptr_t>(end_)) {
+      return allocate_slow(size, align);
+    }
+    cur_ = reinterpret_cast<char *>(p + size);
+    used_ += size;
+    return reinterpret_cast<void *>(p);
+  }
+
+  template <typename T, typename... Args>
+  T *make(Args &&...args) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "Arena objects are never destroyed");
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  // Copies a list built up elsewhere (usually an InlinedVector in the parser)
+  // into the arena
+  template <typename T>
+  absl::Span<const T> list(absl::Span<const T> items) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (items.empty()) { return {}; }
+    auto p = static_cast<T *>(allocate(sizeof(T) * items.size(), alignof(T)));
+    std::memcpy(p, items.data(), sizeof(T) * items.size());
+    return {p, items.size()};
+  }
+
+  template <typename T>
+  absl::Span<const T> list(std::initializer_list<T> items) {
+    return list(absl::Span<const T>(items.begin(), items.size()));
+  }
+
+  absl::string_view copy(absl::string_view str) {
+    if (str.empty()) { return {}; }
+    auto p = static_cast<char *>(allocate(str.length(), 1));
+    std::memcpy(p, str.data(), str.length());
+    return {p, str.length()};
+  }
+
+  size_t bytes_used() const { return used_; }
+};
+
+} // namespace lox
+
+#endif // LOX_ARENA_HPP
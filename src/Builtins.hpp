@@ -7,19 +7,30 @@
 #include <fmt/format.h>
 
 #include <chrono>
+#include <utility>
 
 namespace lox {
 
 class Interpreter;
 
-class Now : public Callable {
+// A function implemented in C++, which needs nothing from whatever is running
+// the program, so that the VM can call it as well as the interpreter
+class Native : public Callable {
+ public:
+  virtual Value call(Args &&) = 0;
+  Value operator()(Interpreter &, Args &&args = {}) override {
+    return call(std::move(args));
+  }
+};
+
+class Now : public Native {
   const std::chrono::time_point<std::chrono::steady_clock> st_ =
       std::chrono::steady_clock::now();
 
  public:
   ~Now() = default;
-  // Doesn't need the interpreter, and has no args
-  ExprResult operator()(Interpreter &, Args && = {}) override {
+  // Has no args
+  Value call(Args &&) override {
     std::chrono::duration<double> ret = std::chrono::steady_clock::now() - st_;
     return ret.count();
   }
@@ -28,10 +39,10 @@ class Now : public Callable {
   std::string to_string() override { return "<fn now>"; }
 };
 
-class Print : public Callable {
+class Print : public Native {
  public:
   ~Print() = default;
-  ExprResult operator()(Interpreter &, Args &&args = {}) override {
+  Value call(Args &&args) override {
     for (const auto &e : args) { fmt::print("{}\n", lox::to_string(e)); }
     return 1.0;
   }
@@ -2,6 +2,7 @@
 #define LOX_CALLABLE_HPP
 
 #include "Expr.hpp"
+#include "Value.hpp"
 
 #include <absl/container/inlined_vector.h>
 
@@ -9,16 +10,22 @@ namespace lox {
 
 class Interpreter;
 
-using Args = absl::InlinedVector<ExprResult, 4>;
+using Args = absl::InlinedVector<Value, 4>;
 
-class Callable {
+class Callable : public Object {
  public:
+  Callable()
+      : Object(Kind::Callable, sizeof(Callable)) {}
   virtual ~Callable() {};
-  virtual ExprResult operator()(Interpreter &, Args&& = {}) = 0;
+  virtual Value operator()(Interpreter &, Args&& = {}) = 0;
   virtual int arity() = 0;
   virtual std::string to_string() = 0;
 };
 
+inline Callable *Value::as_callable() const {
+  return static_cast<Callable *>(object());
+}
+
 } // namespace lox
 
 #endif // LOX_CALLABLE_HPP
@@ -0,0 +1,95 @@
+#ifndef LOX_CHUNK_HPP
+#define LOX_CHUNK_HPP
+
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "Value.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace lox {
+
+#define X(name, _) name,
+
+enum class Op : uint8_t {
+#include "OpCodes.inc"
+};
+
+#define X(name, _) +1
+inline constexpr int op_count = 0
+#include "OpCodes.inc"
+    ;
+
+#define X(_, effect) effect,
+
+// How many values each instruction adds to (or takes off) the stack. CALL
+// and TAIL_CALL also take off their arguments, which the compiler accounts
+// for itself.
+inline constexpr int op_stack_effect[] = {
+#include "OpCodes.inc"
+};
+
+class NativeCode;
+struct Proto;
+
+// Bytecode for one function, or for the top level of a program. An
+// instruction is a one-byte Op, followed by a 32-bit operand for those that
+// take one.
+struct Chunk {
+  std::vector<uint8_t> code;
+  std::vector<Value> constants;
+  std::vector<Proto *> functions;
+  // Slots for the variables of every scope, which sit at the bottom of the
+  // frame, and the most temporaries ever on the stack above them
+  uint32_t frame_size = 0;
+  uint32_t max_stack  = 0;
+  // For the JIT, which may compile a chunk while it is running: how many
+  // times the VM has come into it, and the machine code made from it once
+  // that was often enough
+  mutable uint32_t hotness         = 0;
+  mutable const NativeCode *native = nullptr;
+
+  static bool has_operand(Op op) {
+    using enum Op;
+    switch (op) {
+    case CONSTANT:
+    case GET_LOCAL:
+    case SET_LOCAL:
+    case GET_GLOBAL:
+    case SET_GLOBAL:
+    case DEFINE_GLOBAL:
+    case JUMP:
+    case JUMP_IF_FALSE:
+    case JUMP_IF_TRUE:
+    case POP_JUMP_IF_FALSE:
+    case FUNCTION:
+    case CALL:
+    case TAIL_CALL:
+    case TRY: return true;
+    default: return false;
+    }
+  }
+};
+
+inline uint32_t read_operand(const uint8_t *ip) {
+  uint32_t operand;
+  std::memcpy(&operand, ip, sizeof(operand));
+  return operand;
+}
+
+// A function declaration as the VM runs it. Its chunk is compiled the first
+// time it is called, after parsing the body if the parser skipped it.
+struct Proto {
+  Fn &decl;
+  Chunk chunk;
+  bool compiled = false;
+
+  explicit Proto(Fn &fn)
+      : decl(fn) {}
+};
+
+} // namespace lox
+
+#endif // LOX_CHUNK_HPP
@@ -0,0 +1,302 @@
+#include "Compiler.hpp"
+#include "Utils.hpp"
+
+#include <absl/base/macros.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace lox {
+
+Chunk Compiler::compile_program(StatementsList stmts) {
+  Chunk chunk;
+  chunk_ = &chunk;
+  scopes_.clear();
+  frame_top_ = 0;
+  stack_     = 0;
+  tries_     = 0;
+  loops_.clear();
+  compile(stmts);
+  emit(Op::NIL);
+  emit(Op::RETURN);
+  return chunk;
+}
+
+void Compiler::compile_function(Proto &proto) {
+  auto &decl = proto.decl;
+  chunk_     = &proto.chunk;
+  // Parameters take the first slots of the function's own scope
+  scopes_.assign(1, 0);
+  frame_top_          = decl.slots_;
+  chunk_->frame_size  = decl.slots_;
+  stack_              = 0;
+  tries_              = 0;
+  loops_.clear();
+  compile(decl.statements_);
+  emit(Op::NIL);
+  emit(Op::RETURN);
+  proto.compiled = true;
+}
+
+void Compiler::compile(StatementsList stmts) {
+  for (auto stmt : stmts) {
+    ABSL_ASSERT(stmt);
+    compile(stmt);
+  }
+}
+
+void Compiler::compile_block(StatementsList stmts, uint32_t slots) {
+  auto handler = emit_jump(Op::TRY);
+  tries_++;
+  if (slots) {
+    scopes_.push_back(frame_top_);
+    frame_top_ += slots;
+    chunk_->frame_size = std::max(chunk_->frame_size, frame_top_);
+  }
+  compile(stmts);
+  if (slots) {
+    frame_top_ = scopes_.back();
+    scopes_.pop_back();
+  }
+  emit(Op::END_TRY);
+  tries_--;
+  patch(handler);
+}
+
+void Compiler::end_tries(uint32_t keep) {
+  for (auto i = keep; i < tries_; i++) { emit(Op::END_TRY); }
+}
+
+void Compiler::emit(Op op) {
+  chunk_->code.push_back(static_cast<uint8_t>(op));
+  stack_ += op_stack_effect[static_cast<size_t>(op)];
+  chunk_->max_stack = std::max(chunk_->max_stack, stack_);
+}
+
+void Compiler::emit(Op op, uint32_t operand) {
+  emit(op);
+  auto bytes = reinterpret_cast<const uint8_t *>(&operand);
+  chunk_->code.insert(chunk_->code.end(), bytes, bytes + sizeof(operand));
+}
+
+size_t Compiler::emit_jump(Op op) {
+  emit(op, 0);
+  return chunk_->code.size() - sizeof(uint32_t);
+}
+
+void Compiler::patch(size_t jump) {
+  auto target = here();
+  std::memcpy(chunk_->code.data() + jump, &target, sizeof(target));
+}
+
+uint32_t Compiler::local(Binding binding) const {
+  ABSL_ASSERT(binding.depth < scopes_.size());
+  return scopes_[scopes_.size() - 1 - binding.depth] + binding.slot;
+}
+
+void Compiler::load(Binding binding) {
+  ABSL_ASSERT(binding.depth != Binding::unresolved);
+  if (binding.depth == Binding::global) {
+    emit(Op::GET_GLOBAL, binding.slot);
+  } else {
+    emit(Op::GET_LOCAL, local(binding));
+  }
+}
+
+void Compiler::store(Binding binding) {
+  ABSL_ASSERT(binding.depth != Binding::unresolved);
+  if (binding.depth == Binding::global) {
+    emit(Op::SET_GLOBAL, binding.slot);
+  } else {
+    emit(Op::SET_LOCAL, local(binding));
+  }
+}
+
+// Takes the value off the stack
+void Compiler::define(Binding binding) {
+  if (binding.depth == Binding::global) {
+    emit(Op::DEFINE_GLOBAL, binding.slot);
+  } else {
+    emit(Op::SET_LOCAL, local(binding));
+    emit(Op::POP);
+  }
+}
+
+void Compiler::visitAssignExpr(Assign &a) {
+  compile(a.val_);
+  store(a.binding_);
+}
+
+void Compiler::visitBinaryExpr(Binary &b) {
+  compile(b.left_);
+  if (b.op_.type() == TokenType::COMMA) {
+    emit(Op::POP);
+    compile(b.right_);
+    return;
+  }
+  compile(b.right_);
+
+  using enum TokenType;
+  switch (b.op_.type()) {
+  case MINUS: emit(Op::SUBTRACT); break;
+  case PLUS: emit(Op::ADD); break;
+  case SLASH: emit(Op::DIVIDE); break;
+  case STAR: emit(Op::MULTIPLY); break;
+  case GTR: emit(Op::GREATER); break;
+  case GTR_EQ: emit(Op::GREATER_EQUAL); break;
+  case LESS: emit(Op::LESS); break;
+  case LESS_EQ: emit(Op::LESS_EQUAL); break;
+  case BANG_EQ: emit(Op::NOT_EQUAL); break;
+  case EQ_EQ: emit(Op::EQUAL); break;
+  default: util::unreachable();
+  }
+}
+
+void Compiler::visitTernaryExpr(Ternary &t) {
+  compile(t.cond_);
+  auto else_br = emit_jump(Op::POP_JUMP_IF_FALSE);
+  compile(t.left_);
+  auto end = emit_jump(Op::JUMP);
+  patch(else_br);
+  // Only one of the two branches leaves its value
+  stack_--;
+  compile(t.right_);
+  patch(end);
+}
+
+void Compiler::visitCallExpr(Call &c) {
+  compile(c.callee_);
+  for (auto arg : c.args_) { compile(arg); }
+  auto argc = static_cast<uint32_t>(c.args_.size());
+  emit(c.tail_ ? Op::TAIL_CALL : Op::CALL, argc);
+  stack_ -= argc;
+}
+
+void Compiler::visitGroupExpr(Group &g) { compile(g.expr_); }
+
+void Compiler::visitBoolLiteralExpr(BoolLiteral &b) {
+  emit(b.value_ ? Op::TRUE : Op::FALSE);
+}
+
+void Compiler::visitStrLiteralExpr(StrLiteral &s) {
+  chunk_->constants.emplace_back(s.interned_);
+  emit(Op::CONSTANT, static_cast<uint32_t>(chunk_->constants.size() - 1));
+}
+
+void Compiler::visitNullLiteralExpr(NullLiteral &) { emit(Op::NIL); }
+
+void Compiler::visitNumLiteralExpr(NumLiteral &n) {
+  chunk_->constants.emplace_back(n.value_);
+  emit(Op::CONSTANT, static_cast<uint32_t>(chunk_->constants.size() - 1));
+}
+
+// The result is whichever operand decided it, as it is in the tree-walker
+void Compiler::visitLogicalExpr(Logical &l) {
+  compile(l.left_);
+  auto end = emit_jump(l.op_.type() == TokenType::OR ? Op::JUMP_IF_TRUE
+                                                      : Op::JUMP_IF_FALSE);
+  emit(Op::POP);
+  compile(l.right_);
+  patch(end);
+}
+
+void Compiler::visitVariableExpr(Variable &v) { load(v.binding_); }
+
+void Compiler::visitUnaryExpr(Unary &u) {
+  compile(u.right_);
+  switch (u.op_.type()) {
+  case TokenType::MINUS: emit(Op::NEGATE); break;
+  case TokenType::BANG: emit(Op::NOT); break;
+  default: util::unreachable();
+  }
+}
+
+void Compiler::visitBlockStmt(Block &b) {
+  compile_block(b.statements_, b.slots_);
+}
+
+void Compiler::visitExpressionStmt(Expression &e) {
+  compile(e.expression_);
+  emit(Op::POP);
+}
+
+void Compiler::visitFnStmt(Fn &f) {
+  auto &proto = protos_.emplace_back(std::make_unique<Proto>(f));
+  chunk_->functions.push_back(proto.get());
+  emit(Op::FUNCTION, static_cast<uint32_t>(chunk_->functions.size() - 1));
+  define(f.binding_);
+}
+
+void Compiler::visitIfStmt(If &i) {
+  compile(i.condition_);
+  auto else_br = emit_jump(Op::POP_JUMP_IF_FALSE);
+  compile(i.then_);
+  if (!i.else_br_) {
+    patch(else_br);
+    return;
+  }
+  auto end = emit_jump(Op::JUMP);
+  patch(else_br);
+  compile(i.else_br_);
+  patch(end);
+}
+
+void Compiler::visitWhileStmt(While &w) {
+  auto start = here();
+  compile(w.condition_);
+  auto exit = emit_jump(Op::POP_JUMP_IF_FALSE);
+  loops_.emplace_back(tries_, tries_);
+  size_t handler = 0;
+  if (w.increment_) {
+    handler = emit_jump(Op::TRY);
+    loops_.back().inner_tries = ++tries_;
+  }
+  compile(w.body_);
+  for (auto jump : loops_.back().continues) { patch(jump); }
+  if (w.increment_) {
+    compile(w.increment_);
+    emit(Op::POP);
+    emit(Op::END_TRY);
+    tries_--;
+    patch(handler);
+  }
+  emit(Op::JUMP, start);
+  patch(exit);
+  for (auto jump : loops_.back().breaks) { patch(jump); }
+  loops_.pop_back();
+}
+
+void Compiler::visitVarStmt(Var &v) {
+  if (v.initialiser_) {
+    compile(v.initialiser_);
+  } else {
+    emit(Op::NIL);
+  }
+  define(v.binding_);
+}
+
+void Compiler::visitReturnStmt(Return &r) {
+  if (r.value_) {
+    compile(r.value_);
+  } else {
+    emit(Op::NIL);
+  }
+  end_tries(0);
+  emit(Op::RETURN);
+}
+
+void Compiler::visitBreakStmt(Break &) {
+  ABSL_ASSERT(!loops_.empty());
+  end_tries(loops_.back().outer_tries);
+  loops_.back().breaks.push_back(emit_jump(Op::JUMP));
+}
+
+void Compiler::visitContinueStmt(Continue &) {
+  ABSL_ASSERT(!loops_.empty());
+  end_tries(loops_.back().inner_tries);
+  loops_.back().continues.push_back(emit_jump(Op::JUMP));
+}
+
+} // namespace lox
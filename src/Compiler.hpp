@@ -0,0 +1,115 @@
+#ifndef LOX_COMPILER_HPP
+#define LOX_COMPILER_HPP
+
+#include "Chunk.hpp"
+#include "Expr.hpp"
+#include "Stmt.hpp"
+
+#include <absl/container/inlined_vector.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace lox {
+
+// Turns a resolved tree into bytecode for the VM, one chunk per function and
+// one for the top level of each program.
+//
+// All the scopes of a function share its frame: each block's variables are
+// given the slots above those of the blocks around it, and blocks side by side
+// reuse the same ones. A Binding's depth counts scopes out from the current
+// one, which is all that's needed to find the slot at compile time.
+//
+// Every block is wrapped in a TRY, as the tree-walker runs each one inside a
+// catch-all: an error skips the rest of the innermost block, or failing that
+// ends the innermost function call, which returns nil. A for loop's body and
+// increment get one together. `break`, `continue` and `return` are plain
+// jumps, after an END_TRY for each block they leave.
+//
+// A call the Resolver found in tail position is a TAIL_CALL. If the callee is
+// a compiled function it closes the caller's TRYs itself, once the call can
+// no longer fail, and never gets as far as the instructions after it; a
+// native callee is called as usual, and the END_TRYs and RETURN that follow
+// return its result.
+class Compiler
+    : expr::Visitor<void>
+    , stmt::Visitor<void> {
+  struct Loop {
+    // The TRYs open around the loop, and around its body
+    uint32_t outer_tries;
+    uint32_t inner_tries;
+    // Jumps to patch once the targets are known
+    absl::InlinedVector<size_t, 2> breaks    = {};
+    absl::InlinedVector<size_t, 2> continues = {};
+  };
+
+  // Functions met along the way are added here, to be compiled when first
+  // called; they have to outlive every chunk that refers to them
+  std::vector<std::unique_ptr<Proto>> &protos_;
+  Chunk *chunk_ = nullptr;
+  // Where the slots of each scope of the current function start, innermost
+  // last, and the first slot free above them
+  absl::InlinedVector<uint32_t, 8> scopes_;
+  uint32_t frame_top_ = 0;
+  // Temporaries on the stack at this point in the code
+  uint32_t stack_ = 0;
+  // TRYs open at this point in the current function, and the loops around
+  // it, innermost last
+  uint32_t tries_ = 0;
+  absl::InlinedVector<Loop, 4> loops_;
+
+  void compile(ExprPtr expr) { expr->accept(*this); }
+  void compile(StmtPtr stmt) { stmt->accept(*this); }
+  void compile(StatementsList);
+  void compile_block(StatementsList, uint32_t slots);
+  // Closes the innermost TRYs, down to the outermost `keep`
+  void end_tries(uint32_t keep);
+
+  void emit(Op);
+  void emit(Op, uint32_t operand);
+  // Emits a jump whose target is filled in by patch() once it is known
+  size_t emit_jump(Op);
+  void patch(size_t jump);
+  uint32_t here() const { return static_cast<uint32_t>(chunk_->code.size()); }
+  uint32_t local(Binding) const;
+  void load(Binding);
+  void store(Binding);
+  void define(Binding);
+
+  void visitAssignExpr(Assign &) override;
+  void visitBinaryExpr(Binary &) override;
+  void visitTernaryExpr(Ternary &) override;
+  void visitCallExpr(Call &) override;
+  void visitGroupExpr(Group &) override;
+  void visitBoolLiteralExpr(BoolLiteral &) override;
+  void visitStrLiteralExpr(StrLiteral &) override;
+  void visitNullLiteralExpr(NullLiteral &) override;
+  void visitNumLiteralExpr(NumLiteral &) override;
+  void visitLogicalExpr(Logical &) override;
+  void visitVariableExpr(Variable &) override;
+  void visitUnaryExpr(Unary &) override;
+
+  void visitBlockStmt(Block &) override;
+  void visitExpressionStmt(Expression &) override;
+  void visitFnStmt(Fn &) override;
+  void visitIfStmt(If &) override;
+  void visitWhileStmt(While &) override;
+  void visitVarStmt(Var &) override;
+  void visitReturnStmt(Return &) override;
+  void visitBreakStmt(Break &) override;
+  void visitContinueStmt(Continue &) override;
+
+ public:
+  explicit Compiler(std::vector<std::unique_ptr<Proto>> &protos)
+      : protos_(protos) {}
+
+  // A program's top level, once the Resolver has been over it
+  Chunk compile_program(StatementsList);
+  // A function's body, which must have been parsed and resolved
+  void compile_function(Proto &);
+};
+
+} // namespace lox
+
+#endif // LOX_COMPILER_HPP
@@ -0,0 +1,265 @@
+#include "Document.hpp"
+#include "Parser.hpp"
+#include "Scanner.hpp"
+#include "TokenSource.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lox {
+
+namespace {
+
+// Past this much garbage, and a good deal more garbage than live data, the
+// arena is rebuilt from scratch
+constexpr size_t compact_slack = 1024 * 1024;
+
+// Passes tokens on from a scanner, keeping a copy of each for the document.
+// The parser scans a token ahead, so errors from scanning go with the token
+// they were found in rather than whatever was being parsed at the time.
+class Recorder : public TokenSource {
+  TokenSource &source_;
+
+ public:
+  std::vector<Token> tokens;
+  // Index of the token each was found in; EOF comes after the last token
+  std::vector<std::pair<size_t, Diagnostic>> errors;
+
+  explicit Recorder(TokenSource &source)
+      : source_(source) {}
+
+  Token next_token() override {
+    ErrorCollector scanning;
+    auto tok = source_.next_token();
+    for (auto &error : scanning.take()) {
+      errors.emplace_back(tokens.size(), std::move(error));
+    }
+    if (tok.type() != TokenType::EOF) { tokens.push_back(tok); }
+    return tok;
+  }
+
+  // Errors found in tokens up to `end`, plus those in `parsing`
+  std::vector<Diagnostic> take_errors(size_t &next, size_t end,
+                                      ErrorCollector &parsing) {
+    std::vector<Diagnostic> taken;
+    for (; next < errors.size() && errors[next].first < end; next++) {
+      taken.push_back(std::move(errors[next].second));
+    }
+    for (auto &error : parsing.take()) { taken.push_back(std::move(error)); }
+    return taken;
+  }
+};
+
+int count_lines(absl::string_view text) {
+  return static_cast<int>(std::count(text.begin(), text.end(), '\n'));
+}
+
+Document::Declaration empty_document() {
+  return Document::Declaration{{}, {}, nullptr, {}, 0, 1, 0, 1, 0};
+}
+
+} // namespace
+
+Location Document::Declaration::locate(const Token &tok) const {
+  auto loc   = tok.location();
+  auto shift = static_cast<int>(offset - scanned_offset);
+  return loc.line(loc.line_ + line - scanned_line)
+      .chr(loc.chr_ + shift)
+      .end_chr(loc.end_chr_ + shift);
+}
+
+Document::Document(absl::string_view text) {
+  decls_.push_back(empty_document());
+  reparse(0, 0, text);
+}
+
+Document::Change Document::edit(size_t offset, size_t removed,
+                                absl::string_view inserted) {
+  auto length = size();
+  if (offset > length || removed > length - offset) {
+    throw std::out_of_range("Edit runs past the end of the document");
+  }
+  auto before = decls_.size();
+  auto change = reparse(offset, removed, inserted);
+  if (arena_.bytes_used() > 4 * live_ + compact_slack) {
+    compact();
+    change = Change{0, before, decls_.size(), true};
+  }
+  return change;
+}
+
+size_t Document::find(size_t offset) const {
+  auto it = std::upper_bound(
+      decls_.begin(), decls_.end(), offset,
+      [](size_t off, const Declaration &d) { return off < d.offset; });
+  return static_cast<size_t>(std::distance(decls_.begin(), it)) - 1;
+}
+
+Document::Change Document::reparse(size_t offset, size_t removed,
+                                   absl::string_view inserted) {
+  auto end_of = [this](size_t i) {
+    return decls_[i].offset + decls_[i].text.size();
+  };
+  auto edit_end = offset + removed;
+  // A token ending right where the edit starts may run on into the inserted
+  // text, and the declaration before the one it's in looked at its first
+  // token, e.g. an `if` checking for an `else`
+  auto first = find(offset > 0 ? offset - 1 : 0);
+  if (first > 0) { first--; }
+  auto last_edited = find(edit_end);
+
+  // Where parsing (re)starts, in the edited text
+  auto from = decls_[first].offset;
+  auto line = decls_[first].line;
+  std::vector<Declaration> fresh;
+  // The first old declaration past the new ones, once they line up
+  std::optional<size_t> kept;
+
+  // Parse as far as the declaration after the last one edited. If that isn't
+  // enough to find somewhere to stop, carry on with twice as much.
+  for (size_t extra = 1; !kept; extra *= 2) {
+    auto last  = std::min(last_edited + extra, decls_.size() - 1);
+    auto whole = last == decls_.size() - 1;
+
+    std::string region;
+    for (auto i = first; i <= last; i++) { region += decls_[i].text; }
+    region.replace(offset - decls_[first].offset, removed, inserted);
+    auto text = arena_.copy(
+        absl::string_view(region).substr(from - decls_[first].offset));
+
+    // A region cut short reports errors that aren't there, so nothing is
+    // printed; what was reported goes with each declaration instead
+    ErrorCollector collector;
+    Scanner scanner(text);
+    scanner.start_at(0, line);
+    Recorder recorder(scanner);
+    Parser parser(recorder, arena_);
+
+    auto parsed    = fresh.size();
+    auto from_line = line;
+    // Where each declaration's tokens end, i.e. its lookahead token
+    std::vector<size_t> lookahead;
+    size_t begin = 0, next_token = 0, next_error = 0;
+    auto old = first;
+    while (!parser.done()) {
+      auto used = arena_.bytes_used();
+      auto stmt = parser.parse_declaration();
+      auto end  = parser.position();
+
+      auto tokens_begin = next_token;
+      while (next_token < recorder.tokens.size() &&
+             recorder.tokens[next_token].offset() <= end) {
+        next_token++;
+      }
+      lookahead.push_back(next_token);
+      auto tokens = arena_.list(absl::MakeConstSpan(recorder.tokens)
+                                    .subspan(tokens_begin,
+                                             next_token - tokens_begin));
+      auto decl_text = text.substr(begin, end - begin);
+      fresh.push_back(Declaration{
+          decl_text, tokens, stmt,
+          recorder.take_errors(next_error, next_token, collector), from + begin,
+          line,
+          begin, line, decl_text.size() + arena_.bytes_used() - used});
+      line += count_lines(decl_text);
+      begin = end;
+
+      // Past the inserted text, positions map straight back onto the old
+      // text. An old declaration ending in the same place means the ones
+      // after it would be parsed just as they were, provided the next token
+      // was real text rather than the end of the region.
+      if (whole || from + end <= offset + inserted.size()) { continue; }
+      auto old_end = from + end - inserted.size() + removed;
+      while (old < last && end_of(old) < old_end) { old++; }
+      if (old < last && end_of(old) == old_end) {
+        kept = old + 1;
+        break;
+      }
+    }
+    if (kept) { break; }
+    if (whole) {
+      auto trailer = text.substr(begin);
+      auto errors  = recorder.take_errors(next_error, SIZE_MAX, collector);
+      fresh.push_back(Declaration{trailer, {}, nullptr, std::move(errors),
+                                  from + begin, line, begin, line,
+                                  trailer.size()});
+      kept = decls_.size();
+      break;
+    }
+
+    // Ran into the end of the region. Declarations whose lookahead token was
+    // whole are as good as they will ever be, so only the rest are redone.
+    while (fresh.size() > parsed) {
+      auto next = lookahead[fresh.size() - parsed - 1];
+      if (next < recorder.tokens.size() &&
+          recorder.tokens[next].offset() < text.size()) {
+        break;
+      }
+      fresh.pop_back();
+    }
+    line = from_line;
+    if (fresh.size() > parsed) {
+      auto &back = fresh.back();
+      from       = back.offset + back.text.size();
+      line       = back.line + count_lines(back.text);
+    }
+  }
+
+  // Everything after the new declarations only moves
+  auto shift = *kept < decls_.size() ? line - decls_[*kept].line : 0;
+  for (auto i = *kept; i < decls_.size(); i++) {
+    decls_[i].offset = decls_[i].offset + inserted.size() - removed;
+    decls_[i].line += shift;
+  }
+  for (auto i = first; i < *kept; i++) { live_ -= decls_[i].bytes; }
+  for (auto &decl : fresh) { live_ += decl.bytes; }
+  auto replaced = *kept - first;
+  auto added    = fresh.size();
+  decls_.erase(decls_.begin() + first, decls_.begin() + *kept);
+  decls_.insert(decls_.begin() + first, std::make_move_iterator(fresh.begin()),
+                std::make_move_iterator(fresh.end()));
+  return Change{first, replaced, added, false};
+}
+
+void Document::compact() {
+  auto all = text();
+  arena_   = Arena{};
+  live_    = 0;
+  decls_.assign(1, empty_document());
+  reparse(0, 0, all);
+}
+
+std::vector<StmtPtr> Document::statements() const {
+  std::vector<StmtPtr> stmts;
+  for (auto &decl : decls_) {
+    if (decl.stmt) { stmts.push_back(decl.stmt); }
+  }
+  return stmts;
+}
+
+std::vector<Diagnostic> Document::errors() const {
+  std::vector<Diagnostic> errors;
+  for (auto &decl : decls_) {
+    errors.insert(errors.end(), decl.errors.begin(), decl.errors.end());
+  }
+  return errors;
+}
+
+std::string Document::text() const {
+  std::string text;
+  text.reserve(size());
+  for (auto &decl : decls_) { text.append(decl.text); }
+  return text;
+}
+
+size_t Document::size() const {
+  return decls_.back().offset + decls_.back().text.size();
+}
+
+} // namespace lox
@@ -0,0 +1,74 @@
+#ifndef LOX_DOCUMENT_HPP
+#define LOX_DOCUMENT_HPP
+
+#include "Arena.hpp"
+#include "Error.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+
+#include <absl/strings/string_view.h>
+#include <absl/types/span.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace lox {
+
+// A script kept parsed as it is edited, one top-level declaration at a time.
+// Kept declarations hold the positions they were scanned at; use locate().
+class Document {
+ public:
+  struct Declaration {
+    // Including leading whitespace and comments
+    absl::string_view text;
+    absl::Span<const Token> tokens;
+    // nullptr if it didn't parse
+    StmtPtr stmt;
+    std::vector<Diagnostic> errors;
+    // Where `text` starts in the document now
+    size_t offset;
+    int line;
+    // ... and where it started when its tokens were scanned
+    size_t scanned_offset;
+    int scanned_line;
+    size_t bytes;
+
+    Location locate(const Token &) const;
+  };
+
+  // `removed` declarations from `first` on were replaced by `added` others.
+  // Compacting invalidates every earlier pointer into the document.
+  struct Change {
+    size_t first;
+    size_t removed;
+    size_t added;
+    bool compacted;
+  };
+
+  explicit Document(absl::string_view text);
+
+  // Replaces `removed` bytes at `offset` with `inserted`. Throws
+  // std::out_of_range if that runs past the end of the text.
+  Change edit(size_t offset, size_t removed, absl::string_view inserted);
+
+  // The last entry only holds the trailing text, and has no tokens
+  const std::vector<Declaration> &declarations() const { return decls_; }
+  std::vector<StmtPtr> statements() const;
+  std::vector<Diagnostic> errors() const;
+  std::string text() const;
+  size_t size() const;
+
+ private:
+  Arena arena_;
+  std::vector<Declaration> decls_;
+  size_t live_ = 0;
+
+  size_t find(size_t offset) const;
+  Change reparse(size_t offset, size_t removed, absl::string_view inserted);
+  void compact();
+};
+
+} // namespace lox
+
+#endif // LOX_DOCUMENT_HPP
@@ -1,23 +1,26 @@
 #include "Environment.hpp"
+#include "Heap.hpp"
 
 namespace lox {
 
-bool Environment::assign(Token tok, ExprResult val) {
-  if (auto elem = env_.find(tok.identifier()); elem != env_.end()) {
-    elem->second = val;
-    return true;
+uint32_t Globals::slot(absl::string_view name) {
+  auto [elem, inserted] =
+      slots_.try_emplace(name, static_cast<uint32_t>(values_.size()));
+  if (inserted) {
+    values_.emplace_back();
+    names_.emplace_back(name);
   }
-  return false;
+  return elem->second;
 }
 
-void Environment::define(absl::string_view name, ExprResult val) {
-  env_.emplace(name, val);
+void Globals::define(uint32_t slot, Value value) {
+  if (auto &elem = values_[slot]; !elem) { elem = std::move(value); }
 }
 
-std::optional<ExprResult> Environment::get(Token tok) {
-  auto id = tok.identifier();
-  if (auto elem = env_.find(id); elem != env_.end()) return elem->second;
-  return std::nullopt;
+void Globals::trace(Heap &heap) const {
+  for (auto &value : values_) {
+    if (value) { heap.mark(*value); }
+  }
 }
 
 } // namespace lox
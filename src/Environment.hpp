@@ -1,28 +1,43 @@
 #ifndef LOX_ENVIRONMENT_HPP
 #define LOX_ENVIRONMENT_HPP
 
-#include "Expr.hpp"
-#include "Token.hpp"
-#include "Utils.hpp"
+#include "Value.hpp"
 
 #include <absl/container/flat_hash_map.h>
-#include <absl/container/inlined_vector.h>
+#include <absl/strings/string_view.h>
 
+#include <cstdint>
 #include <optional>
+#include <string>
+#include <vector>
 
 namespace lox {
 
-class Environment {
-  using EnvMap = absl::flat_hash_map<std::string, ExprResult>;
-  EnvMap env_;
+// Global variables, by slot. A slot is handed out the first time the Resolver
+// comes across a name, which may well be before (or without) it ever being
+// defined, so each one may be empty.
+class Globals {
+  absl::flat_hash_map<std::string, uint32_t> slots_;
+  std::vector<std::optional<Value>> values_;
+  std::vector<std::string> names_;
 
  public:
-  bool assign(Token, ExprResult);
-  void define(absl::string_view, ExprResult);
-  std::optional<ExprResult> get(Token);
-};
+  uint32_t slot(absl::string_view name);
+  // Defining a variable that already exists leaves it as it was
+  void define(uint32_t slot, Value);
+  void define(absl::string_view name, Value value) {
+    define(slot(name), std::move(value));
+  }
+
+  const std::string &name(uint32_t slot) const { return names_[slot]; }
 
-using EnvironmentStack = absl::InlinedVector<Environment, 8>;
+  void trace(Heap &) const;
+
+  // Only valid until the next call to slot()
+  std::optional<Value> &operator[](uint32_t slot) {
+    return values_[slot];
+  }
+};
 
 } // namespace lox
 
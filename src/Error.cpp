@@ -1,4 +1,6 @@
+#include <atomic>
 #include <string_view>
+#include <utility>
 
 #include <fmt/format.h>
 
@@ -6,7 +8,28 @@
 
 namespace lox {
 
+namespace {
+
+// Errors can be reported from the parallel scanner's threads
+std::atomic<size_t> errors{0};
+
+thread_local ErrorCollector *collector = nullptr;
+
+} // namespace
+
+size_t error_count() { return errors.load(); }
+
+ErrorCollector::ErrorCollector()
+    : outer_(std::exchange(collector, this)) {}
+
+ErrorCollector::~ErrorCollector() { collector = outer_; }
+
 void report_error(absl::string_view msg, const Location &loc) {
+  if (collector) {
+    collector->add(msg, loc);
+    return;
+  }
+  errors++;
   fmt::print("Error {} in lox program at {}:{}:{}\n", msg, loc.where_,
              loc.line_, loc.chr_);
 }
@@ -3,8 +3,11 @@
 
 #include <absl/strings/string_view.h>
 
+#include <cstddef>
 #include <exception>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace lox {
 
@@ -40,6 +43,33 @@ struct Location {
 };
 
 void report_error(absl::string_view msg, const Location &loc);
+// How many errors have been reported so far
+size_t error_count();
+
+struct Diagnostic {
+  std::string message;
+  Location location;
+};
+
+// While one of these is alive, errors reported on the same thread are kept
+// here rather than printed, and don't count towards error_count(). They nest:
+// only the innermost collector sees anything.
+class ErrorCollector {
+  std::vector<Diagnostic> errors_;
+  ErrorCollector *outer_;
+
+ public:
+  ErrorCollector();
+  ~ErrorCollector();
+  ErrorCollector(const ErrorCollector &)            = delete;
+  ErrorCollector &operator=(const ErrorCollector &) = delete;
+
+  void add(absl::string_view msg, const Location &loc) {
+    errors_.push_back(Diagnostic{std::string(msg), loc});
+  }
+  // Hands over everything collected so far
+  std::vector<Diagnostic> take() { return std::exchange(errors_, {}); }
+};
 
 class ParseError : public std::exception {
   std::string msg_;
@@ -2,21 +2,54 @@
 #define LOX_EXPR_HPP
 
 #include "Token.hpp"
+#include "Value.hpp"
 
-#include <absl/container/inlined_vector.h>
+#include <absl/types/span.h>
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
-#include <variant>
+#include <type_traits>
 
 namespace lox {
 
-class Callable;
-using CallablePtr = std::shared_ptr<Callable>;
+// What evaluating an expression gives
+using ExprResult = Value;
 
-using ExprResult =
-    std::variant<bool, double, std::string, std::nullptr_t, CallablePtr>;
+// Where a variable is found at run time, as worked out by the Resolver: slot
+// `slot` of the scope `depth` scopes out from the innermost one, or of the
+// global slot table
+struct Binding {
+  static constexpr uint32_t global     = UINT32_MAX - 1;
+  static constexpr uint32_t unresolved = UINT32_MAX;
+  uint32_t depth                       = unresolved;
+  uint32_t slot                        = 0;
+};
+
+// What a Binary node has made of the operands it has been given, which the
+// tree-walker uses to take a shorter way through it. A node starts out
+// Unseen. If the first operands it is given are both numbers it becomes its
+// operator on numbers alone, until anything else turns up; from then on, or
+// from the start if they weren't numbers, it is Generic. Once quickened, it
+// also reads operands that are local variables or number literals straight
+// out of the node, rather than evaluating them.
+enum class Quickened : uint8_t {
+  Unseen,
+  Generic,
+  Add,
+  Subtract,
+  Multiply,
+  Divide,
+  Greater,
+  GreaterEqual,
+  Less,
+  LessEqual,
+  Equal,
+  NotEqual,
+};
+
+enum class Operand : uint8_t { Evaluated, Local, Literal };
 
 namespace expr {
 
@@ -28,7 +61,12 @@ struct Visitor;
 struct Expr {
   virtual ExprResult accept(expr::Visitor<ExprResult> &)   = 0;
   virtual std::string accept(expr::Visitor<std::string> &) = 0;
-  virtual ~Expr()                                          = default;
+  virtual void accept(expr::Visitor<void> &)               = 0;
+
+  // Nodes live in an Arena and are never deleted through a base pointer,
+  // which keeps every one of them trivially destructible
+ protected:
+  ~Expr() = default;
 };
 
 struct Assign;
@@ -65,12 +103,14 @@ struct Visitor {
 
 } // namespace expr
 
-using ExprPtr         = std::shared_ptr<Expr>;
-using ExpressionsList = absl::InlinedVector<std::shared_ptr<lox::Expr>, 8>;
+// Owned by the Arena the parser allocated them in
+using ExprPtr         = Expr *;
+using ExpressionsList = absl::Span<const ExprPtr>;
 
 struct Assign : Expr {
   Token name_;
   ExprPtr val_;
+  Binding binding_ = {};
   Assign(Token name, ExprPtr val)
       : name_(name)
       , val_(val) {}
@@ -80,12 +120,18 @@ struct Assign : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitAssignExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitAssignExpr(*this);
+  }
 };
 
 struct Binary : Expr {
   ExprPtr left_;
   ExprPtr right_;
   Token op_;
+  Quickened quickened_   = Quickened::Unseen;
+  Operand left_operand_  = Operand::Evaluated;
+  Operand right_operand_ = Operand::Evaluated;
   Binary(ExprPtr left, ExprPtr right, Token op)
       : left_(left)
       , right_(right)
@@ -96,6 +142,9 @@ struct Binary : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitBinaryExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitBinaryExpr(*this);
+  }
 };
 
 struct Ternary : Expr {
@@ -112,12 +161,16 @@ struct Ternary : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitTernaryExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitTernaryExpr(*this);
+  }
 };
 
 struct Call : Expr {
   ExprPtr callee_;
   Token paren_;
   ExpressionsList args_;
+  bool tail_ = false;
   Call(ExprPtr callee, Token paren, ExpressionsList args)
       : callee_(callee)
       , paren_(paren)
@@ -128,6 +181,9 @@ struct Call : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitCallExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitCallExpr(*this);
+  }
 };
 
 struct Group : Expr {
@@ -140,6 +196,9 @@ struct Group : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitGroupExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitGroupExpr(*this);
+  }
 };
 
 struct BoolLiteral : Expr {
@@ -152,11 +211,15 @@ struct BoolLiteral : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitBoolLiteralExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitBoolLiteralExpr(*this);
+  }
 };
 
 struct StrLiteral : Expr {
-  std::string value_;
-  StrLiteral(std::string value)
+  absl::string_view value_;
+  String *interned_ = nullptr;
+  StrLiteral(absl::string_view value)
       : value_(value) {}
   ExprResult accept(expr::Visitor<ExprResult> &v) override {
     return v.visitStrLiteralExpr(*this);
@@ -164,6 +227,9 @@ struct StrLiteral : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitStrLiteralExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitStrLiteralExpr(*this);
+  }
 };
 
 struct NullLiteral : Expr {
@@ -174,6 +240,9 @@ struct NullLiteral : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitNullLiteralExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitNullLiteralExpr(*this);
+  }
 };
 
 struct NumLiteral : Expr {
@@ -186,6 +255,9 @@ struct NumLiteral : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitNumLiteralExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitNumLiteralExpr(*this);
+  }
 };
 
 struct Logical : Expr {
@@ -202,10 +274,14 @@ struct Logical : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitLogicalExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitLogicalExpr(*this);
+  }
 };
 
 struct Variable : Expr {
   Token name_;
+  Binding binding_ = {};
   Variable(Token name)
       : name_(name) {}
   ExprResult accept(expr::Visitor<ExprResult> &v) override {
@@ -214,6 +290,9 @@ struct Variable : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitVariableExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitVariableExpr(*this);
+  }
 };
 
 struct Unary : Expr {
@@ -228,7 +307,23 @@ struct Unary : Expr {
   std::string accept(expr::Visitor<std::string> &v) override {
     return v.visitUnaryExpr(*this);
   }
+  void accept(expr::Visitor<void> &v) override {
+    return v.visitUnaryExpr(*this);
+  }
 };
 
+static_assert(std::is_trivially_destructible_v<Assign>);
+static_assert(std::is_trivially_destructible_v<Binary>);
+static_assert(std::is_trivially_destructible_v<Ternary>);
+static_assert(std::is_trivially_destructible_v<Call>);
+static_assert(std::is_trivially_destructible_v<Group>);
+static_assert(std::is_trivially_destructible_v<BoolLiteral>);
+static_assert(std::is_trivially_destructible_v<StrLiteral>);
+static_assert(std::is_trivially_destructible_v<NullLiteral>);
+static_assert(std::is_trivially_destructible_v<NumLiteral>);
+static_assert(std::is_trivially_destructible_v<Logical>);
+static_assert(std::is_trivially_destructible_v<Variable>);
+static_assert(std::is_trivially_destructible_v<Unary>);
+
 } // namespace lox
 #endif // LOX_EXPR_HPP
@@ -0,0 +1,573 @@
+#include "FlatAst.hpp"
+#include "Parser.hpp"
+#include "Utils.hpp"
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/inlined_vector.h>
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace lox {
+
+namespace flat {
+
+namespace {
+
+struct OpInfo {
+  TokenType type;
+  absl::string_view spelling;
+};
+
+// Indexed by Op
+constexpr OpInfo ops[] = {
+    {TokenType::EOF, ""},      {TokenType::COMMA, ","},
+    {TokenType::PLUS, "+"},    {TokenType::MINUS, "-"},
+    {TokenType::STAR, "*"},    {TokenType::SLASH, "/"},
+    {TokenType::MINUS, "-"},   {TokenType::BANG, "!"},
+    {TokenType::EQ_EQ, "=="},  {TokenType::BANG_EQ, "!="},
+    {TokenType::LESS, "<"},    {TokenType::LESS_EQ, "<="},
+    {TokenType::GTR, ">"},     {TokenType::GTR_EQ, ">="},
+    {TokenType::AND, "and"},   {TokenType::OR, "or"},
+};
+static_assert(std::size(ops) == static_cast<size_t>(Op::OR) + 1);
+
+Op binary_op(TokenType type) {
+  using enum TokenType;
+  switch (type) {
+  case COMMA: return Op::COMMA;
+  case PLUS: return Op::ADD;
+  case MINUS: return Op::SUB;
+  case STAR: return Op::MUL;
+  case SLASH: return Op::DIV;
+  case EQ_EQ: return Op::EQ;
+  case BANG_EQ: return Op::NE;
+  case LESS: return Op::LT;
+  case LESS_EQ: return Op::LE;
+  case GTR: return Op::GT;
+  case GTR_EQ: return Op::GE;
+  case AND: return Op::AND;
+  case OR: return Op::OR;
+  default: util::unreachable();
+  }
+}
+
+Op unary_op(TokenType type) {
+  switch (type) {
+  case TokenType::MINUS: return Op::NEG;
+  case TokenType::BANG: return Op::NOT;
+  default: util::unreachable();
+  }
+}
+
+} // namespace
+
+TokenType token_type(Op op) { return ops[static_cast<size_t>(op)].type; }
+
+} // namespace flat
+
+using flat::ExprKind;
+using flat::ExprNode;
+using flat::Index;
+using flat::none;
+using flat::Op;
+using flat::StmtKind;
+using flat::StmtNode;
+
+// Walks the pointer tree once, appending each node after its children
+class Lowering
+    : expr::Visitor<void>
+    , stmt::Visitor<void> {
+  FlatAst::Arrays &out_;
+  Index last_ = none;
+  absl::flat_hash_map<absl::string_view, Index> interned_;
+
+  Index intern(absl::string_view str) {
+    auto [it, added] = interned_.try_emplace(str, out_.strings.size());
+    if (added) {
+      out_.strings.push_back({static_cast<uint32_t>(out_.chars.size()),
+                              static_cast<uint32_t>(str.length())});
+      out_.chars.insert(out_.chars.end(), str.begin(), str.end());
+    }
+    return it->second;
+  }
+
+  Index name(const Token &tok) {
+    out_.names.push_back({intern(tok.lexeme()),
+                          static_cast<uint32_t>(tok.line())});
+    return out_.names.size() - 1;
+  }
+
+  Index list(absl::Span<const Index> items) {
+    auto at = out_.lists.size();
+    out_.lists.push_back(items.size());
+    out_.lists.insert(out_.lists.end(), items.begin(), items.end());
+    return at;
+  }
+
+  void emit(ExprNode node) {
+    last_ = out_.exprs.size();
+    out_.exprs.push_back(node);
+  }
+
+  void emit(StmtNode node) {
+    last_ = out_.stmts.size();
+    out_.stmts.push_back(node);
+  }
+
+  void visitAssignExpr(Assign &a) override {
+    auto val = lower(a.val_);
+    emit({.kind = ExprKind::ASSIGN, .a = name(a.name_), .b = val});
+  }
+
+  void visitBinaryExpr(Binary &b) override {
+    auto left  = lower(b.left_);
+    auto right = lower(b.right_);
+    emit({.kind = ExprKind::BINARY,
+          .op   = flat::binary_op(b.op_.type()),
+          .a    = left,
+          .b    = right});
+  }
+
+  void visitTernaryExpr(Ternary &t) override {
+    auto cond  = lower(t.cond_);
+    auto left  = lower(t.left_);
+    auto right = lower(t.right_);
+    emit({.kind = ExprKind::TERNARY, .a = cond, .b = left, .c = right});
+  }
+
+  void visitCallExpr(Call &c) override {
+    auto callee = lower(c.callee_);
+    absl::InlinedVector<Index, 8> args;
+    for (auto arg : c.args_) { args.push_back(lower(arg)); }
+    emit({.kind = ExprKind::CALL, .a = callee, .b = list(args)});
+  }
+
+  void visitGroupExpr(Group &g) override {
+    auto expr = lower(g.expr_);
+    emit({.kind = ExprKind::GROUP, .a = expr});
+  }
+
+  void visitBoolLiteralExpr(BoolLiteral &b) override {
+    emit({.kind = ExprKind::BOOL, .a = b.value_});
+  }
+
+  void visitStrLiteralExpr(StrLiteral &s) override {
+    emit({.kind = ExprKind::STR, .a = intern(s.value_)});
+  }
+
+  void visitNullLiteralExpr(NullLiteral &) override {
+    emit({.kind = ExprKind::NIL});
+  }
+
+  void visitNumLiteralExpr(NumLiteral &n) override {
+    out_.numbers.push_back(n.value_);
+    emit({.kind = ExprKind::NUM,
+          .a    = static_cast<Index>(out_.numbers.size() - 1)});
+  }
+
+  void visitLogicalExpr(Logical &l) override {
+    auto left  = lower(l.left_);
+    auto right = lower(l.right_);
+    emit({.kind = ExprKind::LOGICAL,
+          .op   = flat::binary_op(l.op_.type()),
+          .a    = left,
+          .b    = right});
+  }
+
+  void visitVariableExpr(Variable &v) override {
+    emit({.kind = ExprKind::VARIABLE, .a = name(v.name_)});
+  }
+
+  void visitUnaryExpr(Unary &u) override {
+    auto right = lower(u.right_);
+    emit({.kind = ExprKind::UNARY,
+          .op   = flat::unary_op(u.op_.type()),
+          .a    = right});
+  }
+
+  void visitBlockStmt(Block &b) override {
+    emit({.kind = StmtKind::BLOCK, .a = lower(b.statements_)});
+  }
+
+  void visitExpressionStmt(Expression &e) override {
+    auto expr = lower(e.expression_);
+    emit({.kind = StmtKind::EXPRESSION, .a = expr});
+  }
+
+  void visitFnStmt(Fn &f) override {
+    // The flat form has no notion of a body still to be parsed
+    Parser::parse_body(f);
+    auto fn_name = name(f.name_);
+    absl::InlinedVector<Index, 8> params;
+    for (auto &param : f.tokens_) { params.push_back(name(param)); }
+    auto param_list = list(params);
+    auto body       = lower(f.statements_);
+    emit({.kind = StmtKind::FN, .a = fn_name, .b = param_list, .c = body});
+  }
+
+  void visitIfStmt(If &i) override {
+    auto cond    = lower(i.condition_);
+    auto then    = lower(i.then_);
+    auto else_br = lower(i.else_br_);
+    emit({.kind = StmtKind::IF, .a = cond, .b = then, .c = else_br});
+  }
+
+  void visitWhileStmt(While &w) override {
+    auto cond      = lower(w.condition_);
+    auto body      = lower(w.body_);
+    auto increment = lower(w.increment_);
+    emit({.kind = StmtKind::WHILE, .a = cond, .b = body, .c = increment});
+  }
+
+  void visitVarStmt(Var &v) override {
+    auto var_name = name(v.name_);
+    auto init     = lower(v.initialiser_);
+    emit({.kind = StmtKind::VAR, .a = var_name, .b = init});
+  }
+
+  void visitReturnStmt(Return &r) override {
+    auto value = lower(r.value_);
+    emit({.kind = StmtKind::RETURN, .a = value});
+  }
+
+  void visitBreakStmt(Break &) override { emit({.kind = StmtKind::BREAK}); }
+
+  void visitContinueStmt(Continue &) override {
+    emit({.kind = StmtKind::CONTINUE});
+  }
+
+ public:
+  explicit Lowering(FlatAst::Arrays &out)
+      : out_(out) {}
+
+  Index lower(ExprPtr expr) {
+    if (!expr) { return none; }
+    expr->accept(*this);
+    return last_;
+  }
+
+  Index lower(StmtPtr stmt) {
+    if (!stmt) { return none; }
+    stmt->accept(*this);
+    return last_;
+  }
+
+  Index lower(StatementsList stmts) {
+    absl::InlinedVector<Index, 8> items;
+    // A statement that failed to parse leaves a hole in its block
+    for (auto stmt : stmts) {
+      if (stmt) { items.push_back(lower(stmt)); }
+    }
+    return list(items);
+  }
+};
+
+FlatAst FlatAst::lower(StatementsList program) {
+  FlatAst ast;
+  auto &built  = ast.built_;
+  ast.root_    = Lowering(built).lower(program);
+  ast.exprs_   = built.exprs;
+  ast.stmts_   = built.stmts;
+  ast.names_   = built.names;
+  ast.numbers_ = built.numbers;
+  ast.lists_   = built.lists;
+  ast.strings_ = built.strings;
+  ast.chars_   = {built.chars.data(), built.chars.size()};
+  return ast;
+}
+
+StatementsList FlatAst::inflate(Arena &arena) const {
+  // Strings are copied into the arena the first time a node needs them
+  std::vector<absl::string_view> copied(strings_.size());
+  auto str = [&](Index i) {
+    if (copied[i].data() == nullptr) { copied[i] = arena.copy(string(i)); }
+    return copied[i];
+  };
+  auto ident = [&](Index i) {
+    return Token(TokenType::IDENT, str(names_[i].string), names_[i].line, 0);
+  };
+  auto op = [](Op op) {
+    auto &info = flat::ops[static_cast<size_t>(op)];
+    return Token(info.type, info.spelling, 0, 0);
+  };
+
+  // Children always come first, so a single pass in index order has every
+  // operand built by the time its parent needs it
+  std::vector<ExprPtr> exprs(exprs_.size());
+  auto expr = [&](Index i) { return i == none ? nullptr : exprs[i]; };
+  for (size_t i = 0; i < exprs_.size(); i++) {
+    auto &n = exprs_[i];
+    switch (n.kind) {
+    case ExprKind::ASSIGN:
+      exprs[i] = arena.make<Assign>(ident(n.a), expr(n.b));
+      break;
+    case ExprKind::BINARY:
+      exprs[i] = arena.make<Binary>(expr(n.a), expr(n.b), op(n.op));
+      break;
+    case ExprKind::TERNARY:
+      exprs[i] = arena.make<Ternary>(expr(n.a), expr(n.b), expr(n.c));
+      break;
+    case ExprKind::CALL: {
+      absl::InlinedVector<ExprPtr, 8> args;
+      for (auto arg : list(n.b)) { args.push_back(expr(arg)); }
+      exprs[i] = arena.make<Call>(expr(n.a),
+                                  Token(TokenType::R_PAREN, ")", 0, 0),
+                                  arena.list(absl::MakeConstSpan(args)));
+      break;
+    }
+    case ExprKind::GROUP: exprs[i] = arena.make<Group>(expr(n.a)); break;
+    case ExprKind::BOOL: exprs[i] = arena.make<BoolLiteral>(n.a != 0); break;
+    case ExprKind::STR: exprs[i] = arena.make<StrLiteral>(str(n.a)); break;
+    case ExprKind::NIL: exprs[i] = arena.make<NullLiteral>(); break;
+    case ExprKind::NUM:
+      exprs[i] = arena.make<NumLiteral>(numbers_[n.a]);
+      break;
+    case ExprKind::LOGICAL:
+      exprs[i] = arena.make<Logical>(expr(n.a), expr(n.b), op(n.op));
+      break;
+    case ExprKind::VARIABLE: exprs[i] = arena.make<Variable>(ident(n.a)); break;
+    case ExprKind::UNARY:
+      exprs[i] = arena.make<Unary>(expr(n.a), op(n.op));
+      break;
+    }
+  }
+
+  std::vector<StmtPtr> stmts(stmts_.size());
+  auto stmt = [&](Index i) { return i == none ? nullptr : stmts[i]; };
+  auto stmt_list = [&](Index l) {
+    absl::InlinedVector<StmtPtr, 8> items;
+    for (auto item : list(l)) { items.push_back(stmts[item]); }
+    return arena.list(absl::MakeConstSpan(items));
+  };
+  for (size_t i = 0; i < stmts_.size(); i++) {
+    auto &n = stmts_[i];
+    switch (n.kind) {
+    case StmtKind::BLOCK: stmts[i] = arena.make<Block>(stmt_list(n.a)); break;
+    case StmtKind::EXPRESSION:
+      stmts[i] = arena.make<Expression>(expr(n.a));
+      break;
+    case StmtKind::FN: {
+      absl::InlinedVector<Token, 8> params;
+      for (auto param : list(n.b)) { params.push_back(ident(param)); }
+      stmts[i] = arena.make<Fn>(ident(n.a),
+                                arena.list(absl::MakeConstSpan(params)),
+                                stmt_list(n.c), nullptr);
+      break;
+    }
+    case StmtKind::IF:
+      stmts[i] = arena.make<If>(expr(n.a), stmt(n.b), stmt(n.c));
+      break;
+    case StmtKind::WHILE:
+      stmts[i] = arena.make<While>(expr(n.a), stmt(n.b), expr(n.c));
+      break;
+    case StmtKind::VAR:
+      stmts[i] = arena.make<Var>(ident(n.a), expr(n.b));
+      break;
+    case StmtKind::RETURN: stmts[i] = arena.make<Return>(expr(n.a)); break;
+    case StmtKind::BREAK: stmts[i] = arena.make<Break>(); break;
+    case StmtKind::CONTINUE: stmts[i] = arena.make<Continue>(); break;
+    }
+  }
+  return stmt_list(root_);
+}
+
+namespace {
+
+// The serialised form is a header followed by each array in turn, in host
+// byte order. Sections are ordered so that every one starts suitably aligned
+// for its element type.
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t exprs;
+  uint32_t stmts;
+  uint32_t names;
+  uint32_t numbers;
+  uint32_t lists;
+  uint32_t strings;
+  uint32_t chars;
+  flat::Index root;
+};
+
+constexpr char magic[4] = {'L', 'O', 'X', 'A'};
+
+template <typename T>
+void put(std::string &out, const T *data, size_t count) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  out.append(reinterpret_cast<const char *>(data), sizeof(T) * count);
+}
+
+template <typename T>
+bool take(absl::string_view &in, size_t count, absl::Span<const T> &out) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  if (in.length() / sizeof(T) < count) { return false; }
+  out = {reinterpret_cast<const T *>(in.data()), count};
+  in.remove_prefix(sizeof(T) * count);
+  return true;
+}
+
+} // namespace
+
+std::string FlatAst::serialise() const {
+  Header header{{},
+                format_version,
+                static_cast<uint32_t>(exprs_.size()),
+                static_cast<uint32_t>(stmts_.size()),
+                static_cast<uint32_t>(names_.size()),
+                static_cast<uint32_t>(numbers_.size()),
+                static_cast<uint32_t>(lists_.size()),
+                static_cast<uint32_t>(strings_.size()),
+                static_cast<uint32_t>(chars_.size()),
+                root_};
+  std::memcpy(header.magic, magic, sizeof(magic));
+
+  std::string out;
+  out.reserve(sizeof(header) + memory_usage());
+  put(out, &header, 1);
+  put(out, numbers_.data(), numbers_.size());
+  put(out, exprs_.data(), exprs_.size());
+  put(out, stmts_.data(), stmts_.size());
+  put(out, names_.data(), names_.size());
+  put(out, strings_.data(), strings_.size());
+  put(out, lists_.data(), lists_.size());
+  out.append(chars_);
+  return out;
+}
+
+std::optional<FlatAst> FlatAst::deserialise(absl::string_view in) {
+  Header header;
+  // Each section is only aligned if the first one is
+  if (in.length() < sizeof(header) ||
+      reinterpret_cast<uintptr_t>(in.data()) % alignof(double) != 0) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, in.data(), sizeof(header));
+  in.remove_prefix(sizeof(header));
+  if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      header.version != format_version) {
+    return std::nullopt;
+  }
+
+  FlatAst ast;
+  if (!take(in, header.numbers, ast.numbers_) ||
+      !take(in, header.exprs, ast.exprs_) ||
+      !take(in, header.stmts, ast.stmts_) ||
+      !take(in, header.names, ast.names_) ||
+      !take(in, header.strings, ast.strings_) ||
+      !take(in, header.lists, ast.lists_) || in.length() != header.chars) {
+    return std::nullopt;
+  }
+  ast.chars_ = in;
+  ast.root_  = header.root;
+  if (!ast.validate()) { return std::nullopt; }
+  return ast;
+}
+
+std::optional<FlatAst> FlatAst::deserialise(Source &&file, size_t offset) {
+  auto owned = std::make_unique<Source>(std::move(file));
+  auto text  = owned->text();
+  if (text.length() < offset) { return std::nullopt; }
+  auto ast = deserialise(text.substr(offset));
+  if (ast) { ast->file_ = std::move(owned); }
+  return ast;
+}
+
+bool FlatAst::validate() const {
+  auto is_list = [this](Index l) {
+    return l < lists_.size() && lists_[l] < lists_.size() - l;
+  };
+  auto all_below = [this](Index l, size_t limit) {
+    for (auto item : list(l)) {
+      if (item >= limit) { return false; }
+    }
+    return true;
+  };
+  auto below = [](Index i, size_t limit) { return i < limit; };
+  auto optional = [](Index i, size_t limit) { return i == none || i < limit; };
+
+  for (auto &s : strings_) {
+    if (uint64_t{s.offset} + s.length > chars_.size()) { return false; }
+  }
+  for (auto &n : names_) {
+    if (n.string >= strings_.size()) { return false; }
+  }
+
+  for (size_t i = 0; i < exprs_.size(); i++) {
+    auto &n    = exprs_[i];
+    auto op    = n.op;
+    bool ok    = false;
+    bool arith = op >= Op::COMMA && op <= Op::GE && op != Op::NEG &&
+                 op != Op::NOT;
+    switch (n.kind) {
+    case ExprKind::ASSIGN:
+      ok = below(n.a, names_.size()) && below(n.b, i);
+      break;
+    case ExprKind::BINARY:
+      ok = arith && below(n.a, i) && below(n.b, i);
+      break;
+    case ExprKind::TERNARY:
+      ok = below(n.a, i) && below(n.b, i) && below(n.c, i);
+      break;
+    case ExprKind::CALL:
+      ok = below(n.a, i) && is_list(n.b) && all_below(n.b, i);
+      break;
+    case ExprKind::GROUP: ok = below(n.a, i); break;
+    case ExprKind::BOOL: ok = n.a <= 1; break;
+    case ExprKind::STR: ok = below(n.a, strings_.size()); break;
+    case ExprKind::NIL: ok = true; break;
+    case ExprKind::NUM: ok = below(n.a, numbers_.size()); break;
+    case ExprKind::LOGICAL:
+      ok = (op == Op::AND || op == Op::OR) && below(n.a, i) && below(n.b, i);
+      break;
+    case ExprKind::VARIABLE: ok = below(n.a, names_.size()); break;
+    case ExprKind::UNARY:
+      ok = (op == Op::NEG || op == Op::NOT) && below(n.a, i);
+      break;
+    }
+    if (!ok) { return false; }
+  }
+
+  for (size_t i = 0; i < stmts_.size(); i++) {
+    auto &n = stmts_[i];
+    bool ok = false;
+    switch (n.kind) {
+    case StmtKind::BLOCK: ok = is_list(n.a) && all_below(n.a, i); break;
+    case StmtKind::EXPRESSION: ok = below(n.a, exprs_.size()); break;
+    case StmtKind::FN:
+      ok = below(n.a, names_.size()) && is_list(n.b) &&
+           all_below(n.b, names_.size()) && is_list(n.c) && all_below(n.c, i);
+      break;
+    case StmtKind::IF:
+      ok = below(n.a, exprs_.size()) && below(n.b, i) && optional(n.c, i);
+      break;
+    case StmtKind::WHILE:
+      ok = below(n.a, exprs_.size()) && below(n.b, i) &&
+           optional(n.c, exprs_.size());
+      break;
+    case StmtKind::VAR:
+      ok = below(n.a, names_.size()) && optional(n.b, exprs_.size());
+      break;
+    case StmtKind::RETURN: ok = optional(n.a, exprs_.size()); break;
+    case StmtKind::BREAK:
+    case StmtKind::CONTINUE: ok = true; break;
+    }
+    if (!ok) { return false; }
+  }
+
+  return is_list(root_) && all_below(root_, stmts_.size());
+}
+
+size_t FlatAst::memory_usage() const {
+  if (file_) { return file_->text().length(); }
+  return built_.exprs.capacity() * sizeof(ExprNode) +
+         built_.stmts.capacity() * sizeof(StmtNode) +
+         built_.names.capacity() * sizeof(flat::Name) +
+         built_.numbers.capacity() * sizeof(double) +
+         built_.lists.capacity() * sizeof(Index) +
+         built_.strings.capacity() * sizeof(flat::Slice) +
+         built_.chars.capacity();
+}
+
+} // namespace lox
@@ -0,0 +1,195 @@
+#ifndef LOX_FLATAST_HPP
+#define LOX_FLATAST_HPP
+
+#include "Arena.hpp"
+#include "Expr.hpp"
+#include "Source.hpp"
+#include "Stmt.hpp"
+
+#include <absl/strings/string_view.h>
+#include <absl/types/span.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace lox {
+
+namespace flat {
+
+using Index                 = uint32_t;
+inline constexpr Index none = UINT32_MAX;
+
+enum class ExprKind : uint8_t {
+  ASSIGN,
+  BINARY,
+  TERNARY,
+  CALL,
+  GROUP,
+  BOOL,
+  STR,
+  NIL,
+  NUM,
+  LOGICAL,
+  VARIABLE,
+  UNARY
+};
+
+enum class Op : uint8_t {
+  NONE,
+  COMMA,
+  ADD,
+  SUB,
+  MUL,
+  DIV,
+  NEG,
+  NOT,
+  EQ,
+  NE,
+  LT,
+  LE,
+  GT,
+  GE,
+  AND,
+  OR
+};
+
+enum class StmtKind : uint8_t {
+  BLOCK,
+  EXPRESSION,
+  FN,
+  IF,
+  WHILE,
+  VAR,
+  RETURN,
+  BREAK,
+  CONTINUE
+};
+
+// What a, b and c hold depends on the kind:
+//
+//   ASSIGN    name, value
+//   BINARY    left, right                 (op)
+//   TERNARY   cond, left, right
+//   CALL      callee, list of arguments
+//   GROUP     expr
+//   BOOL      0 or 1
+//   STR       string
+//   NUM       number
+//   LOGICAL   left, right                 (op)
+//   VARIABLE  name
+//   UNARY     right                       (op)
+struct ExprNode {
+  ExprKind kind;
+  Op op;
+  uint16_t spare = 0;
+  Index a        = none;
+  Index b        = none;
+  Index c        = none;
+};
+
+//   BLOCK       list of statements
+//   EXPRESSION  expr
+//   FN          name, list of parameter names, list of statements
+//   IF          condition, then, else (or none)
+//   WHILE       condition, body, increment (or none)
+//   VAR         name, initialiser (or none)
+//   RETURN      value (or none)
+//   BREAK
+//   CONTINUE
+struct StmtNode {
+  StmtKind kind;
+  uint8_t spare[3] = {};
+  Index a          = none;
+  Index b          = none;
+  Index c          = none;
+};
+
+struct Name {
+  Index string;
+  uint32_t line;
+};
+
+struct Slice {
+  uint32_t offset;
+  uint32_t length;
+};
+
+static_assert(sizeof(ExprNode) == 16);
+static_assert(sizeof(StmtNode) == 16);
+
+TokenType token_type(Op);
+
+} // namespace flat
+
+// A program as flat arrays with children before parents, and no pointers.
+// A lowered tree owns its arrays; a deserialised one reads them in place from
+// the bytes it was loaded from.
+class FlatAst {
+  friend class Lowering;
+
+  struct Arrays {
+    std::vector<flat::ExprNode> exprs;
+    std::vector<flat::StmtNode> stmts;
+    std::vector<flat::Name> names;
+    std::vector<double> numbers;
+    // Each list is its length followed by that many indices
+    std::vector<flat::Index> lists;
+    std::vector<flat::Slice> strings;
+    std::vector<char> chars;
+  };
+  // Moving a vector keeps its buffer, and the file is on the heap, so the
+  // views below stay valid when the tree is moved
+  Arrays built_;
+  std::unique_ptr<Source> file_;
+
+  absl::Span<const flat::ExprNode> exprs_;
+  absl::Span<const flat::StmtNode> stmts_;
+  absl::Span<const flat::Name> names_;
+  absl::Span<const double> numbers_;
+  absl::Span<const flat::Index> lists_;
+  absl::Span<const flat::Slice> strings_;
+  absl::string_view chars_;
+  flat::Index root_ = flat::none;
+
+  bool validate() const;
+
+ public:
+  static constexpr uint32_t format_version = 2;
+  // The cache reuses trees only from builds with the same number here. Any
+  // change to the trees the Parser, Optimiser or Lowering make from a script
+  // must bump it, even when format_version stays the same.
+  static constexpr uint32_t semantics_version = 1;
+
+  static FlatAst lower(StatementsList);
+  StatementsList inflate(Arena &arena) const;
+
+  std::string serialise() const;
+  // Reads the tree in place, so `bytes` must outlive it
+  static std::optional<FlatAst> deserialise(absl::string_view bytes);
+  // The same for a tree starting `offset` bytes into `file`, which the tree
+  // then keeps
+  static std::optional<FlatAst> deserialise(Source &&file, size_t offset);
+
+  absl::Span<const flat::ExprNode> exprs() const { return exprs_; }
+  absl::Span<const flat::StmtNode> stmts() const { return stmts_; }
+  absl::Span<const flat::Index> roots() const { return list(root_); }
+
+  absl::Span<const flat::Index> list(flat::Index i) const {
+    return {lists_.data() + i + 1, lists_[i]};
+  }
+  absl::string_view string(flat::Index i) const {
+    return chars_.substr(strings_[i].offset, strings_[i].length);
+  }
+  const flat::Name &name(flat::Index i) const { return names_[i]; }
+  double number(flat::Index i) const { return numbers_[i]; }
+
+  size_t memory_usage() const;
+};
+
+} // namespace lox
+
+#endif // LOX_FLATAST_HPP
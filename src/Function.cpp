@@ -1,15 +1,11 @@
-#include "Environment.hpp"
 #include "Function.hpp"
 #include "Interpreter.hpp"
 
 namespace lox {
 
-ExprResult Function::operator()(Interpreter &interp, Args &&args) {
-  Environment function_env;
-  for (int i = 0; i < decl_.tokens_.size(); i++)
-    function_env.define(decl_.tokens_[i].lexeme(), args[i]);
-  interp.executeBlock(decl_.statements_, std::move(function_env));
-  return nullptr;
+// The Interpreter calls functions itself; this is for anything else
+Value Function::operator()(Interpreter &interp, Args &&args) {
+  return interp.call(decl_, std::move(args));
 }
 
 } // namespace lox
@@ -0,0 +1,137 @@
+#include "Heap.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <optional>
+
+namespace lox {
+
+namespace {
+
+// A number of bytes, optionally in kilobytes or megabytes, e.g. "512k"
+std::optional<size_t> parse_bytes(const char *text) {
+  char *end;
+  auto n = std::strtoull(text, &end, 10);
+  if (end == text) { return std::nullopt; }
+  switch (*end) {
+  case '\0': return n;
+  case 'k':
+  case 'K': return end[1] ? std::nullopt : std::optional<size_t>(n << 10);
+  case 'm':
+  case 'M': return end[1] ? std::nullopt : std::optional<size_t>(n << 20);
+  default: return std::nullopt;
+  }
+}
+
+} // namespace
+
+Heap::Config Heap::Config::from_environment() {
+  Config config;
+  if (auto text = std::getenv("LOX_GC_THRESHOLD"); text && *text) {
+    if (auto bytes = parse_bytes(text); bytes && *bytes > 0) {
+      config.initial_threshold = *bytes;
+    }
+  }
+  if (auto text = std::getenv("LOX_GC_GROWTH"); text && *text) {
+    char *end;
+    auto growth = std::strtod(text, &end);
+    if (!*end && growth >= 1.0) { config.growth = growth; }
+  }
+  return config;
+}
+
+Heap::Heap(Config config)
+    : config_(config)
+    , next_collection_(config.initial_threshold) {}
+
+Heap &heap() {
+  static auto *heap = new Heap(Heap::Config::from_environment());
+  return *heap;
+}
+
+Object::Object(Kind kind, size_t bytes)
+    : kind_(kind) {
+  heap().track(this, bytes);
+}
+
+void Heap::track(Object *obj, size_t bytes) {
+  obj->bytes_ = static_cast<uint32_t>(
+      std::min<size_t>(bytes, std::numeric_limits<uint32_t>::max()));
+  obj->next_ = objects_;
+  objects_   = obj;
+  live_bytes_ += obj->bytes_;
+  stats_.allocated++;
+  stats_.allocated_bytes += obj->bytes_;
+}
+
+void Heap::remove_roots(RootSource *source) {
+  roots_.erase(std::remove(roots_.begin(), roots_.end(), source),
+               roots_.end());
+}
+
+void Heap::mark(const Object *obj) {
+  if (obj->marked_) { return; }
+  const_cast<Object *>(obj)->marked_ = true;
+  gray_.push_back(obj);
+}
+
+void Heap::mark_pending() {
+  while (!gray_.empty()) {
+    auto *obj = gray_.back();
+    gray_.pop_back();
+    obj->trace(*this);
+  }
+}
+
+void Heap::sweep() {
+  auto **link = &objects_;
+  while (auto *obj = *link) {
+    if (obj->marked_ || obj->pinned_) {
+      obj->marked_ = false;
+      link         = &obj->next_;
+      continue;
+    }
+    *link = obj->next_;
+    live_bytes_ -= obj->bytes_;
+    stats_.freed++;
+    stats_.freed_bytes += obj->bytes_;
+    delete obj;
+  }
+}
+
+void Heap::collect() {
+  auto start = std::chrono::steady_clock::now();
+  for (auto *obj = objects_; obj; obj = obj->next_) {
+    if (obj->pinned_) { mark(obj); }
+  }
+  for (auto *source : roots_) { source->trace_roots(*this); }
+  mark_pending();
+  sweep();
+  auto grown = static_cast<double>(live_bytes_) * config_.growth;
+  next_collection_ =
+      std::max(config_.initial_threshold, static_cast<size_t>(grown));
+
+  auto pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start);
+  stats_.collections++;
+  stats_.total_pause += pause;
+  stats_.longest_pause = std::max(stats_.longest_pause, pause);
+}
+
+void Heap::print_stats(std::FILE *out) const {
+  using std::chrono::duration;
+  using ms = duration<double, std::milli>;
+  fmt::print(out, "gc: {} collections, {:.3f} ms paused, longest {:.3f} ms\n",
+             stats_.collections, ms(stats_.total_pause).count(),
+             ms(stats_.longest_pause).count());
+  fmt::print(out, "gc: {} objects ({} bytes) allocated, {} ({} bytes) freed\n",
+             stats_.allocated, stats_.allocated_bytes, stats_.freed,
+             stats_.freed_bytes);
+  fmt::print(out, "gc: {} objects ({} bytes) live, next collection at {}\n",
+             stats_.allocated - stats_.freed, live_bytes_, next_collection_);
+}
+
+} // namespace lox
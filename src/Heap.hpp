@@ -0,0 +1,95 @@
+#ifndef LOX_HEAP_HPP
+#define LOX_HEAP_HPP
+
+#include "Value.hpp"
+
+#include <absl/types/span.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace lox {
+
+class Heap;
+
+// Something holding Values the collector has to know about
+class RootSource {
+ public:
+  virtual ~RootSource() = default;
+  virtual void trace_roots(Heap &) = 0;
+};
+
+// Every Object, and a mark-and-sweep collector that only runs at safepoint(),
+// where whatever is still needed is pinned or reported by a RootSource
+class Heap {
+ public:
+  struct Config {
+    size_t initial_threshold = 1024 * 1024;
+    double growth            = 2.0;
+
+    // $LOX_GC_THRESHOLD (bytes, with k or m) and $LOX_GC_GROWTH
+    static Config from_environment();
+  };
+
+  struct Stats {
+    uint64_t collections   = 0;
+    uint64_t allocated     = 0;
+    uint64_t freed         = 0;
+    size_t allocated_bytes = 0;
+    size_t freed_bytes     = 0;
+    std::chrono::nanoseconds total_pause{0};
+    std::chrono::nanoseconds longest_pause{0};
+  };
+
+ private:
+  Config config_;
+  Stats stats_;
+  Object *objects_ = nullptr;
+  size_t live_bytes_ = 0;
+  size_t next_collection_;
+  std::vector<RootSource *> roots_;
+  // Marked, but whose children haven't been yet
+  std::vector<const Object *> gray_;
+
+  explicit Heap(Config);
+  friend Heap &heap();
+
+  void mark_pending();
+  void sweep();
+
+ public:
+  Heap(const Heap &)            = delete;
+  Heap &operator=(const Heap &) = delete;
+
+  void track(Object *, size_t bytes);
+
+  void add_roots(RootSource *source) { roots_.push_back(source); }
+  void remove_roots(RootSource *source);
+
+  void mark(const Object *);
+  void mark(const Value &value) {
+    if (value.is_object()) { mark(value.as_object()); }
+  }
+  void mark(absl::Span<const Value> values) {
+    for (auto &value : values) { mark(value); }
+  }
+
+  void safepoint() {
+    if (live_bytes_ >= next_collection_) { collect(); }
+  }
+  void collect();
+
+  const Stats &stats() const { return stats_; }
+  size_t live_bytes() const { return live_bytes_; }
+  void print_stats(std::FILE *) const;
+};
+
+// Never destroyed, so objects still around at exit aren't either
+Heap &heap();
+
+} // namespace lox
+
+#endif // LOX_HEAP_HPP
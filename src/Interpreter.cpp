@@ -1,106 +1,227 @@
 #include "Expr.hpp"
 #include "Function.hpp"
 #include "Interpreter.hpp"
+#include "Parser.hpp"
+#include "Profiler.hpp"
+#include "Resolver.hpp"
 #include "Utils.hpp"
 
 #include <absl/base/macros.h>
-#include <absl/container/inlined_vector.h>
 #include <absl/strings/string_view.h>
+#include <absl/types/span.h>
 
 #include <fmt/format.h>
 
 #include <cstddef>
 #include <memory>
 #include <optional>
+#include <utility>
 
 namespace lox {
 
-ExprResult Interpreter::evaluate(ExprPtr expr) { return expr->accept(*this); }
+Value Interpreter::evaluate(ExprPtr expr) { return expr->accept(*this); }
 
-bool isEqual(ExprResult l, ExprResult r) {
-  auto visitor = util::Overloaded(
-      [](bool a, bool b) { return a == b; },
-      [](double a, double b) { return a == b; },
-      [](std::string a, std::string b) { return a == b; },
-      [](std::nullptr_t, std::nullptr_t) { return true; },
-      [](auto, auto) { return false; });
-  return std::visit(visitor, l, r);
+bool isEqual(const Value &l, const Value &r) {
+  if (l.is_number() && r.is_number()) {
+    return l.as_number() == r.as_number();
+  }
+  if (l.is_string() && r.is_string()) {
+    return l.as_string().equals(r.as_string());
+  }
+  // Functions are never equal, not even to themselves
+  if (l.is_callable() || r.is_callable()) { return false; }
+  return l.same_bits(r);
 }
 
-bool isTruthy(ExprResult obj) {
+// Numbers are true unless they are zero; nothing else but `true` is
+bool isTruthy(const Value &obj) {
   // TODO: can I make 0 false? Maybe some int type later
-  struct TruthTeller {
-    bool operator()(bool b) { return b; }
-    bool operator()(ExprResult) { return false; }
-  } tt;
-  return std::visit(tt, obj);
+  if (obj.is_bool()) { return obj.as_bool(); }
+  return obj.is_number() && obj.as_number() != 0;
 }
 
-ExprResult Interpreter::visitAssignExpr(Assign &a) {
-  auto val = evaluate(a.val_);
-  for (auto &e : util::make_reverse(envs_)) {
-    if (e.assign(a.name_, val)) return val;
+void Interpreter::define(Binding binding, Value val) {
+  if (binding.depth == Binding::global) {
+    globals_.define(binding.slot, std::move(val));
+  } else {
+    stack_[scopes_.back() + binding.slot] = val;
+  }
+}
+
+// Assigning to a global that was never defined does nothing
+Value Interpreter::visitAssignExpr(Assign &a) {
+  auto val           = evaluate(a.val_);
+  auto [depth, slot] = a.binding_;
+  ABSL_ASSERT(depth != Binding::unresolved);
+  if (depth != Binding::global) {
+    local(a.binding_) = val;
+  } else if (auto &global = globals_[slot]) {
+    *global = val;
   }
-  auto resolved = global_.assign(a.name_, val);
-  ABSL_ASSERT(resolved &&
-      "Variable being assigned to not found in any environment");
   return val;
 }
 
-// TODO: make the failed std::get exceptions into custom exception that
+namespace {
+
+// TODO: make the BadValueAccess exceptions into custom exception that
 // will track the token that caused the failure and report nicely to the user
-// This function should swallow the exceptions from either std::get or from
+// This function should swallow the exceptions from either number() or from
 // me throwing them directly, then do check the operator and types to provide
 // best-possible error messages (throw BinaryOpError?)
-ExprResult Interpreter::visitBinaryExpr(Binary &b) {
-  auto left  = evaluate(b.left_);
-  auto right = evaluate(b.right_);
-
+Value operate(TokenType op, Value left, Value right) {
   using enum TokenType;
-  switch (b.op_.type()) {
+  switch (op) {
   case COMMA: return right;
-  case MINUS: return std::get<double>(left) - std::get<double>(right);
+  case MINUS: return left.number() - right.number();
   case PLUS:
-    return std::visit(
-        util::Overloaded{
-            [](double a, double b) -> ExprResult { return a + b; },
-            [](std::string a, std::string b) -> ExprResult { return a + b; },
-            [](auto, auto) -> ExprResult {
-              throw RuntimeError("bad args to +");
-            }},
-        left, right);
-  case SLASH: return std::get<double>(left) / std::get<double>(right);
-  case STAR: return std::get<double>(left) * std::get<double>(right);
-  case GTR: return std::get<double>(left) > std::get<double>(right);
-  case GTR_EQ: return std::get<double>(left) >= std::get<double>(right);
-  case LESS: return std::get<double>(left) < std::get<double>(right);
-  case LESS_EQ: return std::get<double>(left) <= std::get<double>(right);
+    if (left.is_number() && right.is_number()) {
+      return left.as_number() + right.as_number();
+    }
+    if (left.is_string() && right.is_string()) {
+      return String::concat(left.as_string(), right.as_string());
+    }
+    throw RuntimeError("bad args to +");
+  case SLASH: return left.number() / right.number();
+  case STAR: return left.number() * right.number();
+  case GTR: return left.number() > right.number();
+  case GTR_EQ: return left.number() >= right.number();
+  case LESS: return left.number() < right.number();
+  case LESS_EQ: return left.number() <= right.number();
   case BANG_EQ: return !isEqual(left, right);
   case EQ_EQ: return isEqual(left, right);
   default: util::unreachable();
   }
 }
 
-ExprResult Interpreter::visitCallExpr(Call &expr) {
-  auto res = evaluate(expr.callee_);
-  Args args;
-  for (auto &arg : expr.args_) args.push_back(evaluate(arg));
-  auto evaluate_call_expr = [this, &args](CallablePtr &func) -> ExprResult {
-    if (args.size() != func->arity())
-      throw RuntimeError(
-          fmt::format("Expected {} arguments to function, got {}.",
-                      func->arity(), args.size()));
-    return (*func)(*this, std::move(args));
-  };
-  auto error_case = [](auto) -> ExprResult {
+// What a Binary node becomes once it has seen two numbers
+Quickened quickened(TokenType op) {
+  using enum TokenType;
+  switch (op) {
+  case PLUS: return Quickened::Add;
+  case MINUS: return Quickened::Subtract;
+  case STAR: return Quickened::Multiply;
+  case SLASH: return Quickened::Divide;
+  case GTR: return Quickened::Greater;
+  case GTR_EQ: return Quickened::GreaterEqual;
+  case LESS: return Quickened::Less;
+  case LESS_EQ: return Quickened::LessEqual;
+  case EQ_EQ: return Quickened::Equal;
+  case BANG_EQ: return Quickened::NotEqual;
+  default: return Quickened::Generic;
+  }
+}
+
+// How a quickened node can get at an operand
+Operand operand_kind(ExprPtr expr) {
+  if (auto var = dynamic_cast<Variable *>(expr)) {
+    return var->binding_.depth == Binding::global ? Operand::Evaluated
+                                                  : Operand::Local;
+  }
+  return dynamic_cast<NumLiteral *>(expr) ? Operand::Literal
+                                          : Operand::Evaluated;
+}
+
+} // namespace
+
+// A node that has only seen numbers checks that it still has two, and goes
+// straight to the arithmetic. The first time it doesn't, it goes the generic
+// way for good, which gives the same result (or error) as ever.
+Value Interpreter::visitBinaryExpr(Binary &b) {
+  if (b.quickened_ <= Quickened::Generic) {
+    return binary(b, evaluate(b.left_));
+  }
+  auto left = operand(b.left_, b.left_operand_);
+  if (!left.is_number()) {
+    b.quickened_ = Quickened::Generic;
+    return binary(b, left);
+  }
+  auto right = operand(b.right_, b.right_operand_);
+  if (!right.is_number()) {
+    b.quickened_ = Quickened::Generic;
+    return operate(b.op_.type(), left, right);
+  }
+  auto l = left.as_number(), r = right.as_number();
+  switch (b.quickened_) {
+  case Quickened::Add: return l + r;
+  case Quickened::Subtract: return l - r;
+  case Quickened::Multiply: return l * r;
+  case Quickened::Divide: return l / r;
+  case Quickened::Greater: return l > r;
+  case Quickened::GreaterEqual: return l >= r;
+  case Quickened::Less: return l < r;
+  case Quickened::LessEqual: return l <= r;
+  case Quickened::Equal: return l == r;
+  case Quickened::NotEqual: return l != r;
+  default: util::unreachable();
+  }
+}
+
+Value Interpreter::binary(Binary &b, Value left) {
+  // Only objects need looking after while the right operand runs
+  auto base = stack_.size();
+  if (left.is_object()) { stack_.push_back(left); }
+  auto right = evaluate(b.right_);
+  stack_.resize(base);
+  if (b.quickened_ == Quickened::Unseen) {
+    if (left.is_number() && right.is_number()) {
+      b.quickened_     = quickened(b.op_.type());
+      b.left_operand_  = operand_kind(b.left_);
+      b.right_operand_ = operand_kind(b.right_);
+    } else {
+      b.quickened_ = Quickened::Generic;
+    }
+  }
+  return operate(b.op_.type(), left, right);
+}
+
+// The callee stays on the stack until the call is over, as nothing else may
+// be keeping it alive by then
+size_t Interpreter::push_call(Call &expr) {
+  auto base = stack_.size();
+  stack_.push_back(evaluate(expr.callee_));
+  for (auto &arg : expr.args_) stack_.push_back(evaluate(arg));
+  auto res = stack_[base];
+  if (!res.is_callable()) {
     throw RuntimeError("Attempted to call expression that was not a function");
-    return {};
-  };
+  }
+  auto &func = *res.as_callable();
+  auto argc  = stack_.size() - base - 1;
+  if (argc != func.arity())
+    throw RuntimeError(fmt::format("Expected {} arguments to function, got {}.",
+                                   func.arity(), argc));
+  return base;
+}
+
+Value Interpreter::finish_call(size_t base) {
+  auto &func = *stack_[base].as_callable();
+  // The arguments are already where the function's frame starts
+  Value result;
+  if (auto fn = dynamic_cast<Function *>(&func)) {
+    result = executeCall(fn->decl(), base + 1);
+  } else {
+    result = func(*this, Args(stack_.begin() + base + 1, stack_.end()));
+  }
+  stack_.resize(base);
+  return result;
+}
 
-  return std::visit(util::Overloaded{evaluate_call_expr, error_case}, res);
+// A tail call to a Lox function is left for executeCall to make, after the
+// `return` this call is the value of. Errors in its callee and arguments are
+// still this function's, and are caught by the blocks around the `return`.
+Value Interpreter::visitCallExpr(Call &expr) {
+  auto base = push_call(expr);
+  if (expr.tail_) {
+    if (auto fn = dynamic_cast<Function *>(stack_[base].as_callable())) {
+      tail_call_ = &fn->decl();
+      tail_args_.assign(stack_.begin() + base + 1, stack_.end());
+      stack_.resize(base);
+      return nullptr;
+    }
+  }
+  return finish_call(base);
 }
 
-ExprResult Interpreter::visitLogicalExpr(Logical &l) {
+Value Interpreter::visitLogicalExpr(Logical &l) {
   auto left = evaluate(l.left_);
   if (l.op_.type() == TokenType::OR) {
     if (isTruthy(left)) return left;
@@ -110,15 +231,15 @@ ExprResult Interpreter::visitLogicalExpr(Logical &l) {
   return evaluate(l.right_);
 }
 
-ExprResult Interpreter::visitTernaryExpr(Ternary &t) {
+Value Interpreter::visitTernaryExpr(Ternary &t) {
   auto cond = isTruthy(evaluate(t.cond_));
   return cond ? evaluate(t.left_) : evaluate(t.right_);
 }
 
-ExprResult Interpreter::visitUnaryExpr(Unary &u) {
+Value Interpreter::visitUnaryExpr(Unary &u) {
   auto right = evaluate(u.right_);
   switch (u.op_.type()) {
-  case TokenType::MINUS: return -std::get<double>(right);
+  case TokenType::MINUS: return -right.number();
   case TokenType::BANG: return !isTruthy(right);
   default:
     util::unreachable();
@@ -126,69 +247,146 @@ ExprResult Interpreter::visitUnaryExpr(Unary &u) {
   }
 }
 
-ExprResult Interpreter::visitVariableExpr(Variable &v) {
-  auto name = v.name_;
-  for (auto &e : util::make_reverse(envs_)) {
-    auto res = e.get(name);
-    if (res) return *res;
-  }
-  auto res = global_.get(name);
-  if (res) return *res;
+Value Interpreter::visitVariableExpr(Variable &v) {
+  auto [depth, slot] = v.binding_;
+  ABSL_ASSERT(depth != Binding::unresolved);
+  if (depth != Binding::global) { return local(v.binding_); }
+  if (auto &global = globals_[slot]) { return *global; }
 
-  throw RuntimeError(absl::StrCat("Undefined variable: ", name.identifier()));
+  throw RuntimeError(
+      absl::StrCat("Undefined variable: ", v.name_.identifier()));
 }
 
-void Interpreter::visitBlockStmt(Block &b) { executeBlock(b.statements_); }
+Completion Interpreter::visitBlockStmt(Block &b) {
+  return executeBlock(b.statements_, b.slots_);
+}
 
-void Interpreter::visitExpressionStmt(Expression &e) {
+Completion Interpreter::visitExpressionStmt(Expression &e) {
   evaluate(e.expression_);
+  return Completion::Normal;
 }
 
-void Interpreter::visitFnStmt(Fn &f) {
-  auto func = std::make_shared<Function>(f);
-  current().define(f.name_.lexeme(), func);
+Completion Interpreter::visitFnStmt(Fn &f) {
+  define(f.binding_, Value(new Function(f)));
+  return Completion::Normal;
 }
 
-void Interpreter::visitIfStmt(If &i) {
-  if (isTruthy(evaluate(i.condition_))) {
-    execute(*i.then_);
-  } else if (i.else_br_) {
-    execute(*i.else_br_);
-  }
+Completion Interpreter::visitIfStmt(If &i) {
+  if (isTruthy(evaluate(i.condition_))) { return execute(*i.then_); }
+  if (i.else_br_) { return execute(*i.else_br_); }
+  return Completion::Normal;
 }
 
-void Interpreter::visitVarStmt(Var &v) {
-  current().define(v.name_.identifier(),
-                   v.initialiser_ ? evaluate(v.initialiser_) : nullptr);
+Completion Interpreter::visitVarStmt(Var &v) {
+  define(v.binding_, v.initialiser_ ? evaluate(v.initialiser_) : nullptr);
+  return Completion::Normal;
 }
 
-void Interpreter::visitWhileStmt(While &w) {
-  while (isTruthy(evaluate(w.condition_))) { execute(*w.body_); }
+// A for loop's body and increment run together as if they were a block,
+// errors and all, which is how the loop used to be written out in full
+Completion Interpreter::visitWhileStmt(While &w) {
+  while (isTruthy(evaluate(w.condition_))) {
+    auto completion = Completion::Normal;
+    if (!w.increment_) {
+      completion = execute(*w.body_);
+    } else {
+      auto base = stack_.size();
+      try {
+        completion = execute(*w.body_);
+        if (completion == Completion::Continue) {
+          completion = Completion::Normal;
+        }
+        if (completion == Completion::Normal) { evaluate(w.increment_); }
+      } catch (...) { stack_.resize(base); }
+    }
+    if (completion == Completion::Break) { break; }
+    if (completion == Completion::Return) { return completion; }
+  }
+  return Completion::Normal;
+}
+
+Completion Interpreter::visitReturnStmt(Return &r) {
+  returned_ = r.value_ ? evaluate(r.value_) : nullptr;
+  return Completion::Return;
 }
 
 // TODO: fix the catch
-void Interpreter::executeBlock(const StatementsList &stmts,
-                               std::optional<Environment> &&env) {
-  std::optional<EnvironmentStack> prior;
-  if (env) {
-    prior = std::move(envs_);
-    envs_ = EnvironmentStack{};
-  }
-  envs_.push_back(env.value_or(Environment{}));
+Completion Interpreter::executeBlock(const StatementsList &stmts,
+                                     uint32_t slots) {
+  auto base = stack_.size();
+  if (slots) {
+    scopes_.push_back(base);
+    stack_.resize(base + slots);
+  }
+  auto completion = Completion::Normal;
   try {
     for (auto &stmt : stmts) {
       ABSL_ASSERT(stmt);
-      execute(*stmt);
+      completion = execute(*stmt);
+      if (completion != Completion::Normal) { break; }
     }
   } catch (...) { ; }
-  envs_.pop_back();
-  if (prior) { envs_ = std::move(*prior); }
+  if (slots) { scopes_.pop_back(); }
+  stack_.resize(base);
+  return completion;
+}
+
+// Only a return can end a function early; the parser keeps break and
+// continue inside loops. A tail call starts the body over with another
+// function in the same frame.
+Value Interpreter::executeCall(Fn &fn, size_t frame) {
+  Value result;
+  ProfiledCall profiled(fn.name_.lexeme(), fn.name_.line());
+  for (auto *decl = &fn;;) {
+    if (decl->lazy_) {
+      Parser::parse_body(*decl);
+      Resolver(globals_, tail_calls_).resolve_function(*decl);
+    }
+    // The variables after the parameters start out nil
+    stack_.resize(frame + decl->slots_);
+    scopes_.push_back(frame);
+    result = nullptr;
+    try {
+      for (auto &stmt : decl->statements_) {
+        ABSL_ASSERT(stmt);
+        if (execute(*stmt) == Completion::Return) {
+          result = returned_;
+          break;
+        }
+      }
+    } catch (...) { ; }
+    scopes_.pop_back();
+    if (!tail_call_) { break; }
+    decl = std::exchange(tail_call_, nullptr);
+    profiled.replace(decl->name_.lexeme(), decl->name_.line());
+    stack_.resize(frame);
+    stack_.insert(stack_.end(), tail_args_.begin(), tail_args_.end());
+    tail_args_.clear();
+  }
+  stack_.resize(frame);
+  return result;
+}
+
+Value Interpreter::call(Fn &decl, Args &&args) {
+  auto frame = stack_.size();
+  stack_.insert(stack_.end(), args.begin(), args.end());
+  return executeCall(decl, frame);
 }
 
-void Interpreter::interpret(StatementsList &&list) {
+void Interpreter::interpret(StatementsList list) {
+  Resolver(globals_, tail_calls_).resolve_program(list);
+  auto base = stack_.size();
   try {
     for (auto const &stmt : list) { execute(*stmt); }
-  } catch (RuntimeError const &e) { report_error(e.what(), Location{}); }
+  } catch (RuntimeError const &e) {
+    stack_.resize(base);
+    report_error(e.what(), Location{});
+  }
+}
+
+void Interpreter::trace_roots(Heap &heap) {
+  globals_.trace(heap);
+  heap.mark(absl::MakeConstSpan(stack_));
 }
 
 } // namespace lox
@@ -2,57 +2,137 @@
 #define LOX_INTERPRETER_HPP
 
 #include "Builtins.hpp"
+#include "Callable.hpp"
 #include "Environment.hpp"
 #include "Expr.hpp"
+#include "Heap.hpp"
 #include "Stmt.hpp"
+#include "Value.hpp"
 
-#include <absl/container/inlined_vector.h>
-
-#include <memory>
-#include <optional>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
 namespace lox {
 
+// Lox's notions of equality and truth, which the optimiser has to agree with
+bool isEqual(const Value &, const Value &);
+bool isTruthy(const Value &);
+
 class Interpreter
-    : public expr::Visitor<ExprResult>
-    , stmt::Visitor<void> {
-  Environment global_;
-  EnvironmentStack envs_;
-
-  Environment &current() { return envs_.size() ? *(envs_.end() - 1) : global_; }
-
-  ExprResult evaluate(ExprPtr);
-  void execute(Stmt &stmt) { stmt.accept(*this); }
-
-  ExprResult visitBoolLiteralExpr(BoolLiteral &b) override { return b.value_; }
-  ExprResult visitNullLiteralExpr(NullLiteral &n) override { return nullptr; }
-  ExprResult visitNumLiteralExpr(NumLiteral &l) override { return l.value_; }
-  ExprResult visitStrLiteralExpr(StrLiteral &s) override { return s.value_; }
-  ExprResult visitGroupExpr(Group &g) override { return evaluate(g.expr_); }
-  ExprResult visitAssignExpr(Assign &) override;
-  ExprResult visitBinaryExpr(Binary &) override;
-  ExprResult visitCallExpr(Call &) override;
-  ExprResult visitLogicalExpr(Logical &) override;
-  ExprResult visitTernaryExpr(Ternary &) override;
-  ExprResult visitUnaryExpr(Unary &) override;
-  ExprResult visitVariableExpr(Variable &) override;
-
-  void visitBlockStmt(Block &) override;
-  void visitExpressionStmt(Expression &) override;
-  void visitFnStmt(Fn &) override;
-  void visitIfStmt(If &) override;
-  void visitVarStmt(Var &) override;
-  void visitWhileStmt(While &) override;
+    : public expr::Visitor<Value>
+    , stmt::Visitor<Completion>
+    , RootSource {
+  Globals globals_;
+  // One stack for everything running now. A call's frame is its arguments,
+  // which are left where they were evaluated, then the rest of its
+  // variables; a block's scope goes on top of whatever is there. In between
+  // are values expressions further up are still holding on to, which the
+  // collector would otherwise not know about: the left operand of a binary
+  // operator while the right one runs, and a call's callee.
+  //
+  // Functions see nothing of the scopes they were defined in, so no variable
+  // ever outlives its frame, and none needs a home of its own on the heap.
+  std::vector<Value> stack_;
+  // Where each scope's variables start in stack_, innermost last. Blocks that
+  // declare nothing don't get one.
+  std::vector<size_t> scopes_;
+  // What the last `return` gave. Read as soon as the function it returns
+  // from sees Completion::Return, before anything else runs.
+  Value returned_;
+  // A call in tail position is left to be made by the function it returns
+  // from, once that function's frame is gone: the callee then runs in the
+  // same frame, one native stack frame deep however many such calls follow
+  // each other. Until then the arguments wait here, where the collector
+  // doesn't look, as it can't run in between.
+  bool tail_calls_;
+  Fn *tail_call_ = nullptr;
+  std::vector<Value> tail_args_;
+
+  Value evaluate(ExprPtr);
+  // Only for locals, i.e. not globals
+  Value &local(Binding binding) {
+    return stack_[scopes_[scopes_.size() - 1 - binding.depth] + binding.slot];
+  }
+  void define(Binding, Value);
+  // An operand of a quickened Binary node
+  Value operand(ExprPtr expr, Operand how) {
+    if (how == Operand::Local) {
+      return local(static_cast<Variable *>(expr)->binding_);
+    }
+    if (how == Operand::Literal) {
+      return static_cast<NumLiteral *>(expr)->value_;
+    }
+    return evaluate(expr);
+  }
+  // The generic way through a Binary node, given its left operand
+  Value binary(Binary &, Value left);
+  // Evaluates a call's callee and arguments onto the stack, and checks that
+  // they go together. Gives where the callee is.
+  size_t push_call(Call &);
+  // Makes the call push_call() set up, and takes it off the stack
+  Value finish_call(size_t base);
+  // Between statements is where the collector may run
+  Completion execute(Stmt &stmt) {
+    heap().safepoint();
+    return stmt.accept(*this);
+  }
+
+  Value visitBoolLiteralExpr(BoolLiteral &b) override { return b.value_; }
+  Value visitNullLiteralExpr(NullLiteral &n) override { return nullptr; }
+  Value visitNumLiteralExpr(NumLiteral &l) override { return l.value_; }
+  // Interned by the Resolver
+  Value visitStrLiteralExpr(StrLiteral &s) override {
+    return Value(s.interned_);
+  }
+  Value visitGroupExpr(Group &g) override { return evaluate(g.expr_); }
+  Value visitAssignExpr(Assign &) override;
+  Value visitBinaryExpr(Binary &) override;
+  Value visitCallExpr(Call &) override;
+  Value visitLogicalExpr(Logical &) override;
+  Value visitTernaryExpr(Ternary &) override;
+  Value visitUnaryExpr(Unary &) override;
+  Value visitVariableExpr(Variable &) override;
+
+  Completion visitBlockStmt(Block &) override;
+  Completion visitExpressionStmt(Expression &) override;
+  Completion visitFnStmt(Fn &) override;
+  Completion visitIfStmt(If &) override;
+  Completion visitVarStmt(Var &) override;
+  Completion visitWhileStmt(While &) override;
+  Completion visitReturnStmt(Return &) override;
+  Completion visitBreakStmt(Break &) override { return Completion::Break; }
+  Completion visitContinueStmt(Continue &) override {
+    return Completion::Continue;
+  }
 
  public:
-  Interpreter() {
-    current().define("now", std::shared_ptr<Callable>(new Now{}));
-    current().define("print", std::shared_ptr<Callable>(new Print{}));
+  // With `tail_calls` off, every call gets a frame of its own, so that
+  // deep recursion looks the way it was written
+  explicit Interpreter(bool tail_calls = true)
+      : tail_calls_(tail_calls) {
+    globals_.define("now", Value(new Now{}));
+    globals_.define("print", Value(new Print{}));
+    heap().add_roots(this);
   }
+  ~Interpreter() override { heap().remove_roots(this); }
+  Interpreter(const Interpreter &)            = delete;
+  Interpreter &operator=(const Interpreter &) = delete;
+
+  void trace_roots(Heap &) override;
+
+  // Resolves the program's variables, then runs it
+  void interpret(StatementsList);
+  // Runs a block in a new scope of `slots` variables
+  Completion executeBlock(const StatementsList &, uint32_t slots);
+  // Runs a function body in a frame of its own, which starts with the
+  // arguments on the stack from `frame` on, and then drops them. Gives
+  // what the function returned.
+  Value executeCall(Fn &, size_t frame);
+  // Calls a function with arguments from anywhere else
+  Value call(Fn &, Args &&);
 
-  void interpret(StatementsList &&);
-  void executeBlock(const StatementsList &,
-                    std::optional<Environment> && = std::nullopt);
+  Globals &globals() { return globals_; }
 };
 
 } // namespace lox
@@ -0,0 +1,567 @@
+#include "Interpreter.hpp"
+#include "Jit.hpp"
+#include "VM.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "The JIT only targets x86-64 Linux"
+#endif
+
+namespace lox {
+
+namespace {
+
+enum Reg : uint8_t {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// What the callee-saved registers hold while machine code runs
+constexpr Reg SP    = RBX; // the VM's stack pointer
+constexpr Reg SLOTS = R12; // the frame's variables
+constexpr Reg VMP   = R13; // the VM, for calls back into it
+constexpr Reg NANS  = R14; // the bits that make a Value anything but a number
+constexpr Reg BOOLS = R15; // false; true is one more
+
+enum Cond : uint8_t {
+  O, NO, B, AE, E, NE, BE, A, S, NS, P, NP, L, GE, LE, G,
+};
+
+// Just enough of an x86-64 assembler for the templates. Only the first eight
+// XMM registers are used, and only AL, CL and DL of the byte registers, so
+// neither ever needs a REX prefix.
+class Assembler {
+  std::vector<uint8_t> code_;
+
+  void rex(bool wide, Reg reg, Reg rm) {
+    uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (prefix != 0x40) { byte(prefix); }
+  }
+  void direct(Reg reg, Reg rm) { byte(0xC0 | (reg & 7) << 3 | (rm & 7)); }
+  // [base + disp]
+  void indirect(Reg reg, Reg base, int32_t disp) {
+    auto small = disp >= -128 && disp < 128;
+    byte((small ? 0x40 : 0x80) | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == RSP) { byte(0x24); }
+    if (small) {
+      byte(static_cast<uint8_t>(disp));
+    } else {
+      u32(static_cast<uint32_t>(disp));
+    }
+  }
+  void sse(uint8_t prefix, uint8_t op, int dst, int src) {
+    if (prefix) { byte(prefix); }
+    byte(0x0F);
+    byte(op);
+    direct(Reg(dst), Reg(src));
+  }
+
+ public:
+  size_t size() const { return code_.size(); }
+  const std::vector<uint8_t> &code() const { return code_; }
+
+  void byte(uint8_t b) { code_.push_back(b); }
+  void u32(uint32_t n) {
+    auto bytes = reinterpret_cast<const uint8_t *>(&n);
+    code_.insert(code_.end(), bytes, bytes + sizeof(n));
+  }
+  void u64(uint64_t n) {
+    auto bytes = reinterpret_cast<const uint8_t *>(&n);
+    code_.insert(code_.end(), bytes, bytes + sizeof(n));
+  }
+
+  void push(Reg r) {
+    rex(false, RAX, r);
+    byte(0x50 + (r & 7));
+  }
+  void pop(Reg r) {
+    rex(false, RAX, r);
+    byte(0x58 + (r & 7));
+  }
+  void ret() { byte(0xC3); }
+
+  void mov(Reg dst, Reg src) {
+    rex(true, src, dst);
+    byte(0x89);
+    direct(src, dst);
+  }
+  void mov(Reg dst, uint64_t imm) {
+    rex(true, RAX, dst);
+    byte(0xB8 + (dst & 7));
+    u64(imm);
+  }
+  void mov32(Reg dst, uint32_t imm) {
+    rex(false, RAX, dst);
+    byte(0xB8 + (dst & 7));
+    u32(imm);
+  }
+  void load(Reg dst, Reg base, int32_t disp) {
+    rex(true, dst, base);
+    byte(0x8B);
+    indirect(dst, base, disp);
+  }
+  void store(Reg base, int32_t disp, Reg src) {
+    rex(true, src, base);
+    byte(0x89);
+    indirect(src, base, disp);
+  }
+  void lea(Reg dst, Reg base, int32_t disp) {
+    rex(true, dst, base);
+    byte(0x8D);
+    indirect(dst, base, disp);
+  }
+  void add(Reg dst, int8_t imm) {
+    rex(true, RAX, dst);
+    byte(0x83);
+    direct(Reg(0), dst);
+    byte(static_cast<uint8_t>(imm));
+  }
+  void sub(Reg dst, int8_t imm) {
+    rex(true, RAX, dst);
+    byte(0x83);
+    direct(Reg(5), dst);
+    byte(static_cast<uint8_t>(imm));
+  }
+  void add(Reg dst, Reg src) {
+    rex(true, src, dst);
+    byte(0x01);
+    direct(src, dst);
+  }
+  void and_(Reg dst, Reg src) {
+    rex(true, src, dst);
+    byte(0x21);
+    direct(src, dst);
+  }
+  void cmp(Reg a, Reg b) {
+    rex(true, b, a);
+    byte(0x39);
+    direct(b, a);
+  }
+  // Flips one bit
+  void btc(Reg r, uint8_t bit) {
+    rex(true, RAX, r);
+    byte(0x0F);
+    byte(0xBA);
+    direct(Reg(7), r);
+    byte(bit);
+  }
+
+  void setcc(Cond cond, Reg r) {
+    byte(0x0F);
+    byte(0x90 + cond);
+    direct(Reg(0), r);
+  }
+  void and8(Reg dst, Reg src) {
+    byte(0x20);
+    direct(src, dst);
+  }
+  void or8(Reg dst, Reg src) {
+    byte(0x08);
+    direct(src, dst);
+  }
+  void xor8(Reg dst, uint8_t imm) {
+    byte(0x80);
+    direct(Reg(6), dst);
+    byte(imm);
+  }
+  void test8(Reg a, Reg b) {
+    byte(0x84);
+    direct(b, a);
+  }
+  // Zero-extends a byte register into the whole of another
+  void movzx8(Reg dst, Reg src) {
+    byte(0x0F);
+    byte(0xB6);
+    direct(dst, src);
+  }
+
+  void movq_to_xmm(int dst, Reg src) {
+    byte(0x66);
+    rex(true, Reg(dst), src);
+    byte(0x0F);
+    byte(0x6E);
+    direct(Reg(dst), src);
+  }
+  void movq_from_xmm(Reg dst, int src) {
+    byte(0x66);
+    rex(true, Reg(src), dst);
+    byte(0x0F);
+    byte(0x7E);
+    direct(Reg(src), dst);
+  }
+  void addsd(int dst, int src) { sse(0xF2, 0x58, dst, src); }
+  void subsd(int dst, int src) { sse(0xF2, 0x5C, dst, src); }
+  void mulsd(int dst, int src) { sse(0xF2, 0x59, dst, src); }
+  void divsd(int dst, int src) { sse(0xF2, 0x5E, dst, src); }
+  void ucomisd(int a, int b) { sse(0x66, 0x2E, a, b); }
+  void xorpd(int dst, int src) { sse(0x66, 0x57, dst, src); }
+
+  void call(Reg r) {
+    rex(false, RAX, r);
+    byte(0xFF);
+    direct(Reg(2), r);
+  }
+  void jmp(Reg r) {
+    rex(false, RAX, r);
+    byte(0xFF);
+    direct(Reg(4), r);
+  }
+  // Jumps to be pointed somewhere by patch(), which is given what these give
+  size_t jmp() {
+    byte(0xE9);
+    u32(0);
+    return size() - sizeof(uint32_t);
+  }
+  size_t jcc(Cond cond) {
+    byte(0x0F);
+    byte(0x80 + cond);
+    u32(0);
+    return size() - sizeof(uint32_t);
+  }
+  void patch(size_t jump, size_t target) {
+    auto rel = static_cast<int32_t>(target - (jump + sizeof(uint32_t)));
+    std::memcpy(code_.data() + jump, &rel, sizeof(rel));
+  }
+  // Points the jump here
+  void land(size_t jump) { patch(jump, size()); }
+};
+
+// Mirrors of what the VM does itself, for the machine code to call
+bool values_equal(Value left, Value right) noexcept {
+  return isEqual(left, right);
+}
+bool values_differ(Value left, Value right) noexcept {
+  return !isEqual(left, right);
+}
+
+template <typename F>
+uint64_t address(F *f) {
+  return reinterpret_cast<uint64_t>(f);
+}
+
+uint32_t threshold_from_environment() {
+  if (auto text = std::getenv("LOX_JIT_THRESHOLD"); text && *text) {
+    char *end;
+    auto n = std::strtoul(text, &end, 10);
+    if (!*end && n > 0 && n <= UINT32_MAX) { return static_cast<uint32_t>(n); }
+  }
+  return Jit::default_threshold;
+}
+
+} // namespace
+
+NativeCode::~NativeCode() { munmap(memory_, size_); }
+
+NativeExit NativeCode::run(VM &vm, Value *slots, Value *sp,
+                           size_t offset) const {
+  using Entry = NativeExit (*)(Value *, Value *, const void *, VM *);
+  auto entry  = reinterpret_cast<Entry>(memory_);
+  return entry(slots, sp, static_cast<uint8_t *>(memory_) + starts_[offset],
+               &vm);
+}
+
+Jit::Jit(VM &vm)
+    : vm_(vm)
+    , threshold_(threshold_from_environment()) {}
+
+bool Jit::get_global(VM &vm, uint32_t slot, Value *to) noexcept {
+  auto &global = vm.globals_[slot];
+  if (!global) { return false; }
+  *to = *global;
+  return true;
+}
+
+void Jit::set_global(VM &vm, uint32_t slot, Value value) noexcept {
+  if (auto &global = vm.globals_[slot]) { *global = value; }
+}
+
+void Jit::define_global(VM &vm, uint32_t slot, Value value) noexcept {
+  vm.globals_.define(slot, value);
+}
+
+void Jit::begin_try(VM &vm, Value *sp, uint32_t target) noexcept {
+  vm.handlers_.push_back(VM::Handler{
+      vm.frames_.size() - 1, static_cast<size_t>(sp - vm.stack_.data()),
+      target});
+}
+
+void Jit::end_try(VM &vm) noexcept { vm.handlers_.pop_back(); }
+
+// The code starts with the way in, which saves the registers it is going to
+// use, sets them up and jumps to the instruction it was asked to start at,
+// and the way out, which puts them back. Every instruction the templates
+// can't see through leaves by the way out with the stack pointer and the
+// offset of that instruction, for the VM to carry on from.
+void Jit::compile(const Chunk &chunk) {
+  using enum Op;
+  Assembler a;
+  a.push(RBX);
+  a.push(R12);
+  a.push(R13);
+  a.push(R14);
+  a.push(R15);
+  a.mov(SLOTS, RDI);
+  a.mov(SP, RSI);
+  a.mov(VMP, RCX);
+  a.mov(NANS, Value::quiet_nan);
+  a.mov(BOOLS, Value::false_bits);
+  a.jmp(RDX);
+
+  auto way_out = a.size();
+  a.pop(R15);
+  a.pop(R14);
+  a.pop(R13);
+  a.pop(R12);
+  a.pop(RBX);
+  a.ret();
+
+  auto &code = chunk.code;
+  std::vector<uint32_t> starts(code.size());
+  // Jumps to patch once every instruction has its code: to other
+  // instructions, and to the way out from an instruction
+  std::vector<std::pair<size_t, uint32_t>> jumps, exits;
+
+  auto leave = [&](uint32_t offset) {
+    a.mov(RAX, SP);
+    a.mov32(RDX, offset);
+    a.patch(a.jmp(), way_out);
+  };
+  auto call = [&](uint64_t function) {
+    a.mov(RAX, function);
+    a.call(RAX);
+  };
+  // Leaves at `offset` unless `r` holds a number. Uses RSI.
+  auto guard_number = [&](Reg r, uint32_t offset) {
+    a.mov(RSI, r);
+    a.and_(RSI, NANS);
+    a.cmp(RSI, NANS);
+    exits.emplace_back(a.jcc(E), offset);
+  };
+  // The top two values, as numbers, in XMM0 and XMM1
+  auto numbers = [&](uint32_t offset) {
+    a.load(RAX, SP, -16);
+    a.load(RCX, SP, -8);
+    guard_number(RAX, offset);
+    guard_number(RCX, offset);
+    a.movq_to_xmm(0, RAX);
+    a.movq_to_xmm(1, RCX);
+  };
+  // Replaces the top two values with the bool in AL
+  auto push_bool = [&] {
+    a.movzx8(RAX, RAX);
+    a.add(RAX, BOOLS);
+    a.store(SP, -16, RAX);
+    a.sub(SP, 8);
+  };
+  // Whether the value in RAX is truthy, in AL: true, or a number that isn't
+  // zero. Uses RCX, RSI and the first two XMM registers.
+  auto truthy = [&] {
+    a.mov(RSI, RAX);
+    a.and_(RSI, NANS);
+    a.cmp(RSI, NANS);
+    auto number = a.jcc(NE);
+    a.lea(RCX, BOOLS, 1);
+    a.cmp(RAX, RCX);
+    a.setcc(E, RAX);
+    auto done = a.jmp();
+    a.land(number);
+    a.movq_to_xmm(0, RAX);
+    a.xorpd(1, 1);
+    a.ucomisd(0, 1);
+    a.setcc(NE, RAX);
+    a.setcc(P, RCX);
+    a.or8(RAX, RCX);
+    a.land(done);
+  };
+  auto push_bits = [&](uint64_t bits) {
+    a.mov(RAX, bits);
+    a.store(SP, 0, RAX);
+    a.add(SP, 8);
+  };
+
+  for (uint32_t at = 0; at < code.size();) {
+    auto op      = static_cast<Op>(code[at]);
+    auto operand = Chunk::has_operand(op) ? read_operand(&code[at + 1]) : 0;
+    auto slot    = static_cast<int32_t>(operand * sizeof(Value));
+    starts[at]   = static_cast<uint32_t>(a.size());
+
+    switch (op) {
+    case CONSTANT: push_bits(chunk.constants[operand].bits_); break;
+    case NIL: push_bits(Value::nil_bits); break;
+    case TRUE: push_bits(Value::true_bits); break;
+    case FALSE: push_bits(Value::false_bits); break;
+    case POP: a.sub(SP, 8); break;
+    case GET_LOCAL:
+      a.load(RAX, SLOTS, slot);
+      a.store(SP, 0, RAX);
+      a.add(SP, 8);
+      break;
+    case SET_LOCAL:
+      a.load(RAX, SP, -8);
+      a.store(SLOTS, slot, RAX);
+      break;
+    // An undefined global is left to the VM to complain about
+    case GET_GLOBAL:
+      a.mov(RDI, VMP);
+      a.mov32(RSI, operand);
+      a.mov(RDX, SP);
+      call(address(&Jit::get_global));
+      a.test8(RAX, RAX);
+      exits.emplace_back(a.jcc(E), at);
+      a.add(SP, 8);
+      break;
+    case SET_GLOBAL:
+      a.mov(RDI, VMP);
+      a.mov32(RSI, operand);
+      a.load(RDX, SP, -8);
+      call(address(&Jit::set_global));
+      break;
+    case DEFINE_GLOBAL:
+      a.mov(RDI, VMP);
+      a.mov32(RSI, operand);
+      a.load(RDX, SP, -8);
+      a.sub(SP, 8);
+      call(address(&Jit::define_global));
+      break;
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+    case DIVIDE:
+      numbers(at);
+      if (op == ADD) { a.addsd(0, 1); }
+      if (op == SUBTRACT) { a.subsd(0, 1); }
+      if (op == MULTIPLY) { a.mulsd(0, 1); }
+      if (op == DIVIDE) { a.divsd(0, 1); }
+      a.movq_from_xmm(RAX, 0);
+      a.store(SP, -16, RAX);
+      a.sub(SP, 8);
+      break;
+    // Comparisons with NaN are all false, which is what ucomisd's flags
+    // give above and above-or-equal, so less-than swaps the operands round
+    case GREATER:
+    case GREATER_EQUAL:
+    case LESS:
+    case LESS_EQUAL:
+      numbers(at);
+      if (op == GREATER || op == GREATER_EQUAL) {
+        a.ucomisd(0, 1);
+      } else {
+        a.ucomisd(1, 0);
+      }
+      a.setcc(op == GREATER || op == LESS ? A : AE, RAX);
+      push_bool();
+      break;
+    // Numbers are compared here, and anything else by isEqual()
+    case EQUAL:
+    case NOT_EQUAL: {
+      a.load(RAX, SP, -16);
+      a.load(RCX, SP, -8);
+      std::vector<size_t> slow;
+      for (auto r : {RAX, RCX}) {
+        a.mov(RSI, r);
+        a.and_(RSI, NANS);
+        a.cmp(RSI, NANS);
+        slow.push_back(a.jcc(E));
+      }
+      a.movq_to_xmm(0, RAX);
+      a.movq_to_xmm(1, RCX);
+      a.ucomisd(0, 1);
+      if (op == EQUAL) {
+        a.setcc(E, RAX);
+        a.setcc(NP, RCX);
+        a.and8(RAX, RCX);
+      } else {
+        a.setcc(NE, RAX);
+        a.setcc(P, RCX);
+        a.or8(RAX, RCX);
+      }
+      auto done = a.jmp();
+      for (auto jump : slow) { a.land(jump); }
+      a.mov(RDI, RAX);
+      a.mov(RSI, RCX);
+      call(op == EQUAL ? address(&values_equal) : address(&values_differ));
+      a.land(done);
+      push_bool();
+      break;
+    }
+    case NEGATE:
+      a.load(RAX, SP, -8);
+      guard_number(RAX, at);
+      a.btc(RAX, 63);
+      a.store(SP, -8, RAX);
+      break;
+    case NOT:
+      a.load(RAX, SP, -8);
+      truthy();
+      a.xor8(RAX, 1);
+      a.movzx8(RAX, RAX);
+      a.add(RAX, BOOLS);
+      a.store(SP, -8, RAX);
+      break;
+    case JUMP: jumps.emplace_back(a.jmp(), operand); break;
+    case JUMP_IF_FALSE:
+    case JUMP_IF_TRUE:
+    case POP_JUMP_IF_FALSE:
+      a.load(RAX, SP, -8);
+      if (op == POP_JUMP_IF_FALSE) { a.sub(SP, 8); }
+      truthy();
+      a.test8(RAX, RAX);
+      jumps.emplace_back(a.jcc(op == JUMP_IF_TRUE ? NE : E), operand);
+      break;
+    case TRY:
+      a.mov(RDI, VMP);
+      a.mov(RSI, SP);
+      a.mov32(RDX, operand);
+      call(address(&Jit::begin_try));
+      break;
+    case END_TRY:
+      a.mov(RDI, VMP);
+      call(address(&Jit::end_try));
+      break;
+    // Calls and returns change frames, and making a function allocates
+    case FUNCTION:
+    case CALL:
+    case TAIL_CALL:
+    case RETURN: leave(at); break;
+    }
+    at += Chunk::has_operand(op) ? 1 + sizeof(uint32_t) : 1;
+  }
+  for (auto [jump, target] : jumps) { a.patch(jump, starts[target]); }
+  // One way out for each instruction that needs it
+  std::sort(exits.begin(), exits.end(),
+            [](auto &l, auto &r) { return l.second < r.second; });
+  size_t stub = 0;
+  for (size_t i = 0; i < exits.size(); i++) {
+    if (i == 0 || exits[i].second != exits[i - 1].second) {
+      stub = a.size();
+      leave(exits[i].second);
+    }
+    a.patch(exits[i].first, stub);
+  }
+
+  auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto size = (a.size() + page - 1) / page * page;
+  auto *memory =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+           -1, 0);
+  // Without memory for it the chunk just carries on being interpreted
+  if (memory == MAP_FAILED) { return; }
+  std::memcpy(memory, a.code().data(), a.size());
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    return;
+  }
+  auto native = std::make_unique<NativeCode>(memory, size, std::move(starts));
+  chunk.native = native.get();
+  code_.push_back(std::move(native));
+}
+
+} // namespace lox
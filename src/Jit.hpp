@@ -0,0 +1,73 @@
+#ifndef LOX_JIT_HPP
+#define LOX_JIT_HPP
+
+#include "Chunk.hpp"
+#include "Value.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace lox {
+
+class VM;
+
+// Where machine code stopped: the top of the stack, and the instruction the
+// VM carries on from
+struct NativeExit {
+  Value *sp;
+  uint64_t offset;
+};
+
+// One chunk's machine code, which runs on the VM's stack from any instruction
+class NativeCode {
+  void *memory_;
+  size_t size_;
+  // Where the code for each instruction starts, by bytecode offset
+  std::vector<uint32_t> starts_;
+
+ public:
+  NativeCode(void *memory, size_t size, std::vector<uint32_t> starts)
+      : memory_(memory)
+      , size_(size)
+      , starts_(std::move(starts)) {}
+  ~NativeCode();
+  NativeCode(const NativeCode &)            = delete;
+  NativeCode &operator=(const NativeCode &) = delete;
+
+  NativeExit run(VM &, Value *slots, Value *sp, size_t offset) const;
+};
+
+// Compiles hot chunks to x86-64, leaving anything but the common case to the
+// VM at the instruction it comes to
+class Jit {
+  VM &vm_;
+  uint32_t threshold_;
+  std::vector<std::unique_ptr<NativeCode>> code_;
+
+  void compile(const Chunk &);
+
+  // Called from machine code, so they never throw
+  static bool get_global(VM &, uint32_t slot, Value *to) noexcept;
+  static void set_global(VM &, uint32_t slot, Value) noexcept;
+  static void define_global(VM &, uint32_t slot, Value) noexcept;
+  static void begin_try(VM &, Value *sp, uint32_t target) noexcept;
+  static void end_try(VM &) noexcept;
+
+ public:
+  static constexpr uint32_t default_threshold = 1000;
+
+  explicit Jit(VM &vm);
+
+  // Whether the chunk has machine code, compiling it once it is hot
+  bool ready(const Chunk &chunk) {
+    if (!chunk.native && ++chunk.hotness == threshold_) { compile(chunk); }
+    return chunk.native != nullptr;
+  }
+};
+
+} // namespace lox
+
+#endif // LOX_JIT_HPP
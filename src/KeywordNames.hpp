@@ -5,11 +5,104 @@
 
 #include <absl/strings/string_view.h>
 
-#include <unordered_map>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 
 namespace lox {
 
-const std::unordered_map<absl::string_view, TokenType> &get_keywords();
+namespace keywords {
+
+struct Keyword {
+  absl::string_view name;
+  TokenType type;
+};
+
+#define X(TOKEN, token) Keyword{#token, TokenType::TOKEN},
+
+inline constexpr Keyword all_tokens[] = {
+#include "TokenTypes.inc"
+};
+
+// Everything from AND up to (but not including) EOF is spelled as a keyword
+inline constexpr size_t first = static_cast<size_t>(TokenType::AND);
+inline constexpr size_t count = static_cast<size_t>(TokenType::EOF) - first;
+
+inline constexpr size_t min_length = [] {
+  size_t len = SIZE_MAX;
+  for (size_t i = first; i < first + count; i++)
+    len = all_tokens[i].name.length() < len ? all_tokens[i].name.length() : len;
+  return len;
+}();
+
+inline constexpr size_t max_length = [] {
+  size_t len = 0;
+  for (size_t i = first; i < first + count; i++)
+    len = all_tokens[i].name.length() > len ? all_tokens[i].name.length() : len;
+  return len;
+}();
+
+// The hash only looks at the first and last characters and the length, which
+// is enough to tell all of the keywords apart. The multipliers are searched
+// for at compile time, so adding a keyword to TokenTypes.inc either finds a
+// new collision-free pair or fails the static_assert below.
+inline constexpr size_t slots = 64;
+
+struct Params {
+  uint32_t first_mul;
+  uint32_t last_mul;
+};
+
+constexpr uint32_t hash(absl::string_view s, Params p) {
+  return (static_cast<unsigned char>(s.front()) * p.first_mul +
+          static_cast<unsigned char>(s.back()) * p.last_mul + s.length()) %
+         slots;
+}
+
+constexpr Params find_params() {
+  for (uint32_t a = 1; a < 256; a++) {
+    for (uint32_t b = 1; b < 256; b++) {
+      bool used[slots] = {};
+      bool ok          = true;
+      for (size_t i = first; ok && i < first + count; i++) {
+        auto h = hash(all_tokens[i].name, {a, b});
+        ok     = !used[h];
+        used[h] = true;
+      }
+      if (ok) { return {a, b}; }
+    }
+  }
+  return {0, 0};
+}
+
+inline constexpr Params params = find_params();
+static_assert(params.first_mul != 0,
+              "No collision-free keyword hash found, increase keywords::slots");
+
+inline constexpr auto table = [] {
+  std::array<Keyword, slots> t{};
+  for (auto &slot : t) slot = {"", TokenType::IDENT};
+  for (size_t i = first; i < first + count; i++)
+    t[hash(all_tokens[i].name, params)] = all_tokens[i];
+  return t;
+}();
+
+} // namespace keywords
+
+// Classifies an identifier-shaped lexeme as either a keyword or IDENT. No
+// hashing beyond a couple of multiplies, no heap and nothing to initialise,
+// so it is safe to use from any number of scanners at once.
+constexpr TokenType keyword_type(absl::string_view ident) {
+  if (ident.length() < keywords::min_length ||
+      ident.length() > keywords::max_length) {
+    return TokenType::IDENT;
+  }
+  const auto &slot = keywords::table[keywords::hash(ident, keywords::params)];
+  return slot.name == ident ? slot.type : TokenType::IDENT;
+}
+
+static_assert(keyword_type("while") == TokenType::WHILE);
+static_assert(keyword_type("whale") == TokenType::IDENT);
 
 } // namespace lox
 
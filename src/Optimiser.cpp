@@ -0,0 +1,276 @@
+#include "Optimiser.hpp"
+#include "Interpreter.hpp"
+#include "Parser.hpp"
+#include "Utils.hpp"
+
+#include <absl/base/macros.h>
+
+#include <algorithm>
+#include <string>
+
+namespace lox {
+
+namespace {
+
+// Mirrors Interpreter::visitBinaryExpr, but gives up on anything that would
+// throw at run time so the error still happens when and where it should
+std::optional<ExprResult> fold_binary(TokenType op, const ExprResult &left,
+                                      const ExprResult &right) {
+  using enum TokenType;
+  if (op == EQ_EQ) { return ExprResult(isEqual(left, right)); }
+  if (op == BANG_EQ) { return ExprResult(!isEqual(left, right)); }
+
+  if (op == PLUS && left.is_string() && right.is_string()) {
+    return String::concat(left.as_string(), right.as_string());
+  }
+
+  if (!left.is_number() || !right.is_number()) { return std::nullopt; }
+  auto l = left.as_number(), r = right.as_number();
+  switch (op) {
+  case PLUS: return ExprResult(l + r);
+  case MINUS: return ExprResult(l - r);
+  case STAR: return ExprResult(l * r);
+  case SLASH: return ExprResult(l / r);
+  case GTR: return ExprResult(l > r);
+  case GTR_EQ: return ExprResult(l >= r);
+  case LESS: return ExprResult(l < r);
+  case LESS_EQ: return ExprResult(l <= r);
+  default: return std::nullopt;
+  }
+}
+
+} // namespace
+
+StatementsList Optimiser::optimise(StatementsList stmts) {
+  ListBuilder<StmtPtr> kept;
+  for (auto stmt : stmts) {
+    if (auto folded = fold(stmt)) { kept.push_back(folded); }
+  }
+  if (kept.size() == stmts.size()) {
+    // Nothing was dropped, but statements may still have been replaced
+    if (std::equal(kept.begin(), kept.end(), stmts.begin())) { return stmts; }
+  }
+  return arena_.list(absl::MakeConstSpan(kept));
+}
+
+ExprPtr Optimiser::fold(ExprPtr expr) {
+  value_.reset();
+  expr->accept(*this);
+  return expr_;
+}
+
+StmtPtr Optimiser::fold(StmtPtr stmt) {
+  stmt->accept(*this);
+  return stmt_;
+}
+
+StmtPtr Optimiser::fold_required(StmtPtr stmt) {
+  if (auto folded = fold(stmt)) { return folded; }
+  return arena_.make<Block>(StatementsList{});
+}
+
+ExprPtr Optimiser::literal(const ExprResult &value) {
+  if (value.is_number()) { return arena_.make<NumLiteral>(value.as_number()); }
+  if (value.is_bool()) { return arena_.make<BoolLiteral>(value.as_bool()); }
+  if (value.is_string()) {
+    return arena_.make<StrLiteral>(arena_.copy(value.as_string().text()));
+  }
+  ABSL_ASSERT(value.is_nil());
+  return arena_.make<NullLiteral>();
+}
+
+void Optimiser::visitAssignExpr(Assign &a) {
+  a.val_ = fold(a.val_);
+  expr_  = &a;
+  value_.reset();
+}
+
+void Optimiser::visitBinaryExpr(Binary &b) {
+  b.left_    = fold(b.left_);
+  auto left  = value_;
+  b.right_   = fold(b.right_);
+  auto right = value_;
+  expr_      = &b;
+  value_.reset();
+
+  // A literal on the left of a comma does nothing at all
+  if (b.op_.type() == TokenType::COMMA && left) {
+    folded_++;
+    expr_  = b.right_;
+    value_ = right;
+    return;
+  }
+  if (!left || !right) { return; }
+  if (auto result = fold_binary(b.op_.type(), *left, *right)) {
+    folded_++;
+    expr_  = literal(*result);
+    value_ = std::move(result);
+  }
+}
+
+void Optimiser::visitTernaryExpr(Ternary &t) {
+  t.cond_    = fold(t.cond_);
+  auto cond  = value_;
+  t.left_    = fold(t.left_);
+  auto left  = value_;
+  t.right_   = fold(t.right_);
+  auto right = value_;
+  expr_      = &t;
+  value_.reset();
+
+  if (!cond) { return; }
+  folded_++;
+  auto pick = isTruthy(*cond);
+  expr_     = pick ? t.left_ : t.right_;
+  value_    = pick ? left : right;
+}
+
+void Optimiser::visitCallExpr(Call &c) {
+  c.callee_ = fold(c.callee_);
+  ListBuilder<ExprPtr> args;
+  for (auto arg : c.args_) { args.push_back(fold(arg)); }
+  if (!std::equal(args.begin(), args.end(), c.args_.begin())) {
+    c.args_ = arena_.list(absl::MakeConstSpan(args));
+  }
+  expr_ = &c;
+  value_.reset();
+}
+
+// Parentheses only matter to the parser; the value is simply passed through
+void Optimiser::visitGroupExpr(Group &g) {
+  folded_++;
+  expr_ = fold(g.expr_);
+}
+
+void Optimiser::visitBoolLiteralExpr(BoolLiteral &b) {
+  expr_  = &b;
+  value_ = b.value_;
+}
+
+void Optimiser::visitStrLiteralExpr(StrLiteral &s) {
+  expr_  = &s;
+  value_ = std::string(s.value_);
+}
+
+void Optimiser::visitNullLiteralExpr(NullLiteral &n) {
+  expr_  = &n;
+  value_ = nullptr;
+}
+
+void Optimiser::visitNumLiteralExpr(NumLiteral &n) {
+  expr_  = &n;
+  value_ = n.value_;
+}
+
+void Optimiser::visitLogicalExpr(Logical &l) {
+  l.left_    = fold(l.left_);
+  auto left  = value_;
+  l.right_   = fold(l.right_);
+  auto right = value_;
+  expr_      = &l;
+  value_.reset();
+
+  if (!left) { return; }
+  folded_++;
+  // `or` stops at a truthy left hand side, `and` at a falsy one
+  auto take_left = (l.op_.type() == TokenType::OR) == isTruthy(*left);
+  expr_          = take_left ? l.left_ : l.right_;
+  value_         = take_left ? left : right;
+}
+
+void Optimiser::visitVariableExpr(Variable &v) {
+  expr_ = &v;
+  value_.reset();
+}
+
+void Optimiser::visitUnaryExpr(Unary &u) {
+  u.right_   = fold(u.right_);
+  auto right = value_;
+  expr_      = &u;
+  value_.reset();
+
+  if (!right) { return; }
+  std::optional<ExprResult> result;
+  if (u.op_.type() == TokenType::BANG) {
+    result = !isTruthy(*right);
+  } else if (right->is_number()) {
+    result = -right->as_number();
+  }
+  if (result) {
+    folded_++;
+    expr_  = literal(*result);
+    value_ = std::move(result);
+  }
+}
+
+// Empty blocks are dropped altogether, and so is anything optimised away
+// inside a block
+void Optimiser::visitBlockStmt(Block &b) {
+  b.statements_ = optimise(b.statements_);
+  stmt_         = b.statements_.empty() ? nullptr : &b;
+}
+
+// A statement that is just a literal can't do anything
+void Optimiser::visitExpressionStmt(Expression &e) {
+  e.expression_ = fold(e.expression_);
+  stmt_         = &e;
+  if (value_) {
+    folded_++;
+    stmt_ = nullptr;
+  }
+}
+
+// Bodies the parser skipped are optimised once they have been parsed
+void Optimiser::visitFnStmt(Fn &f) {
+  if (f.lazy_) {
+    f.lazy_->optimise = true;
+  } else {
+    f.statements_ = optimise(f.statements_);
+  }
+  stmt_ = &f;
+}
+
+void Optimiser::visitIfStmt(If &i) {
+  i.condition_ = fold(i.condition_);
+  if (auto cond = value_) {
+    folded_++;
+    if (isTruthy(*cond)) {
+      stmt_ = fold(i.then_);
+    } else {
+      stmt_ = i.else_br_ ? fold(i.else_br_) : nullptr;
+    }
+    return;
+  }
+  i.then_ = fold_required(i.then_);
+  if (i.else_br_) { i.else_br_ = fold(i.else_br_); }
+  stmt_ = &i;
+}
+
+// A loop whose condition is a falsy literal never runs
+void Optimiser::visitWhileStmt(While &w) {
+  w.condition_ = fold(w.condition_);
+  if (value_ && !isTruthy(*value_)) {
+    folded_++;
+    stmt_ = nullptr;
+    return;
+  }
+  w.body_ = fold_required(w.body_);
+  if (w.increment_) { w.increment_ = fold(w.increment_); }
+  stmt_ = &w;
+}
+
+void Optimiser::visitVarStmt(Var &v) {
+  if (v.initialiser_) { v.initialiser_ = fold(v.initialiser_); }
+  stmt_ = &v;
+}
+
+void Optimiser::visitReturnStmt(Return &r) {
+  if (r.value_) { r.value_ = fold(r.value_); }
+  stmt_ = &r;
+}
+
+void Optimiser::visitBreakStmt(Break &b) { stmt_ = &b; }
+
+void Optimiser::visitContinueStmt(Continue &c) { stmt_ = &c; }
+
+} // namespace lox
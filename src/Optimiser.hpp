@@ -0,0 +1,75 @@
+#ifndef LOX_OPTIMISER_HPP
+#define LOX_OPTIMISER_HPP
+
+#include "Arena.hpp"
+#include "Expr.hpp"
+#include "Stmt.hpp"
+
+#include <cstddef>
+#include <optional>
+
+namespace lox {
+
+// Simplifies a freshly parsed tree before it is run. Operators whose operands
+// are all literals are evaluated once, here, instead of on every execution;
+// `and`/`or`/`?:` with a literal on the left pick their branch; ifs and loops
+// with a literal condition lose the code that can never run; parentheses
+// disappear. Nothing that could have a side effect or raise an error is
+// touched, so the optimised tree does exactly what the original would have.
+//
+// Nodes are rewritten in place, and anything new (folded literals, shortened
+// statement lists) is allocated in the arena the tree came from. Scripts are
+// cached optimised, so changing what this produces means bumping
+// FlatAst::semantics_version.
+class Optimiser
+    : expr::Visitor<void>
+    , stmt::Visitor<void> {
+  Arena &arena_;
+  // Set by every visit: what the expression or statement is replaced by, and
+  // for expressions that end up as a literal, its value
+  ExprPtr expr_;
+  StmtPtr stmt_;
+  std::optional<ExprResult> value_;
+  size_t folded_ = 0;
+
+  ExprPtr fold(ExprPtr);
+  StmtPtr fold(StmtPtr);
+  // Never returns nullptr, for places where a statement has to remain
+  StmtPtr fold_required(StmtPtr);
+  ExprPtr literal(const ExprResult &);
+
+  void visitAssignExpr(Assign &) override;
+  void visitBinaryExpr(Binary &) override;
+  void visitTernaryExpr(Ternary &) override;
+  void visitCallExpr(Call &) override;
+  void visitGroupExpr(Group &) override;
+  void visitBoolLiteralExpr(BoolLiteral &) override;
+  void visitStrLiteralExpr(StrLiteral &) override;
+  void visitNullLiteralExpr(NullLiteral &) override;
+  void visitNumLiteralExpr(NumLiteral &) override;
+  void visitLogicalExpr(Logical &) override;
+  void visitVariableExpr(Variable &) override;
+  void visitUnaryExpr(Unary &) override;
+
+  void visitBlockStmt(Block &) override;
+  void visitExpressionStmt(Expression &) override;
+  void visitFnStmt(Fn &) override;
+  void visitIfStmt(If &) override;
+  void visitWhileStmt(While &) override;
+  void visitVarStmt(Var &) override;
+  void visitReturnStmt(Return &) override;
+  void visitBreakStmt(Break &) override;
+  void visitContinueStmt(Continue &) override;
+
+ public:
+  explicit Optimiser(Arena &arena)
+      : arena_(arena) {}
+
+  StatementsList optimise(StatementsList);
+  // How many nodes were folded away or removed so far
+  size_t folded() const { return folded_; }
+};
+
+} // namespace lox
+
+#endif // LOX_OPTIMISER_HPP
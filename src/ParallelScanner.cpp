@@ -0,0 +1,139 @@
+#include "ParallelScanner.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace lox {
+
+namespace {
+
+// The next newline, or the end
+const char *skip_line(const char *p, const char *end) {
+  auto nl = static_cast<const char *>(std::memchr(p, '\n', end - p));
+  return nl ? nl : end;
+}
+
+// The only lexical state that can be live at a newline. Comments end there,
+// so whoever starts scanning after one is either in a string or not.
+enum class LexState { CODE, STRING };
+
+struct ChunkSummary {
+  LexState exit_from_code; // state at the end, if we entered in code
+  int newlines;
+};
+
+// Where does a chunk leave us, given the state it starts in? This only has to
+// find quotes and comment markers, so it is far cheaper than scanning.
+LexState run_states(const char *p, const char *end, LexState state) {
+  while (p != end) {
+    if (state == LexState::STRING) {
+      auto quote = static_cast<const char *>(std::memchr(p, '"', end - p));
+      if (!quote) { return LexState::STRING; }
+      p     = quote + 1;
+      state = LexState::CODE;
+      continue;
+    }
+    auto c = *p++;
+    if (c == '"') {
+      state = LexState::STRING;
+    } else if (c == '/' && p != end && *p == '/') {
+      p = skip_line(p, end);
+    }
+  }
+  return state;
+}
+
+int count_newlines(const char *p, const char *end) {
+  int count = 0;
+  while ((p = static_cast<const char *>(std::memchr(p, '\n', end - p)))) {
+    count++;
+    p++;
+  }
+  return count;
+}
+
+// Runs fn(0) .. fn(n - 1), each on its own thread
+template <typename F>
+void parallel_for(size_t n, F &&fn) {
+  std::vector<std::thread> workers;
+  workers.reserve(n ? n - 1 : 0);
+  for (size_t i = 1; i < n; i++) workers.emplace_back(fn, i);
+  if (n) fn(0);
+  for (auto &w : workers) w.join();
+}
+
+} // namespace
+
+TokenBuffer tokenise_parallel(absl::string_view source, unsigned threads) {
+  if (!threads) { threads = std::max(1u, std::thread::hardware_concurrency()); }
+  if (threads == 1 || source.length() < 2 * threads) {
+    return Scanner(source).tokenise_compact();
+  }
+
+  // Cut roughly evenly, then move each cut to just after the next newline
+  auto b = source.data();
+  auto e = b + source.length();
+  std::vector<size_t> cuts{0};
+  for (unsigned i = 1; i < threads; i++) {
+    auto from = std::max(cuts.back(), source.length() * i / threads);
+    auto nl   = skip_line(b + from, e);
+    if (nl == e) { break; }
+    auto cut = static_cast<size_t>(nl - b) + 1;
+    if (cut > cuts.back() && cut < source.length()) { cuts.push_back(cut); }
+  }
+  cuts.push_back(source.length());
+
+  auto chunks = cuts.size() - 1;
+  std::vector<ChunkSummary> summaries(chunks);
+  parallel_for(chunks, [&](size_t i) {
+    auto from    = b + cuts[i];
+    auto to      = b + cuts[i + 1];
+    summaries[i] = {run_states(from, to, LexState::CODE),
+                    count_newlines(from, to)};
+  });
+
+  // Walk the chunks in order to find out which state each one really starts
+  // in. A string running across a cut means the cut has to go: merge the
+  // chunk into its predecessor. The re-run from inside a string only happens
+  // for chunks where that is actually the case.
+  struct Chunk {
+    size_t begin;
+    size_t end;
+    int line;
+  };
+  std::vector<Chunk> work;
+  auto state = LexState::CODE;
+  int line   = 1;
+  for (size_t i = 0; i < chunks; i++) {
+    if (state == LexState::CODE) {
+      work.push_back({cuts[i], cuts[i + 1], line});
+      state = summaries[i].exit_from_code;
+    } else {
+      work.back().end = cuts[i + 1];
+      state = run_states(b + cuts[i], b + cuts[i + 1], LexState::STRING);
+    }
+    line += summaries[i].newlines;
+  }
+
+  std::vector<TokenBuffer> parts(work.size(), TokenBuffer(source));
+  parallel_for(work.size(), [&](size_t i) {
+    // Give each scanner the source up to the end of its chunk, so it stops
+    // there but token offsets still count from the very beginning
+    auto &chunk = work[i];
+    Scanner scanner(source.substr(0, chunk.end));
+    scanner.start_at(chunk.begin, chunk.line);
+    parts[i] = scanner.tokenise_compact();
+  });
+
+  TokenBuffer tokens(source);
+  size_t total = 1;
+  for (auto &part : parts) total += part.size();
+  tokens.reserve(total);
+  for (auto &part : parts) tokens.splice(part);
+  tokens.push_back(TokenType::EOF, source.length(), 0);
+  return tokens;
+}
+
+} // namespace lox
@@ -0,0 +1,34 @@
+#ifndef LOX_PARALLELSCANNER_HPP
+#define LOX_PARALLELSCANNER_HPP
+
+#include "Scanner.hpp"
+#include "TokenBuffer.hpp"
+
+#include <absl/strings/string_view.h>
+
+#include <cstddef>
+
+namespace lox {
+
+// Below this there aren't enough bytes per thread to pay for the threads
+inline constexpr size_t parallel_scan_threshold = 8 * 1024 * 1024;
+
+// Tokenises the source on several threads at once and returns the same
+// TokenBuffer a single Scanner would have produced.
+//
+// Tokens never span a newline except inside string literals, so the source
+// is cut into chunks just after a newline. A cheap pass over each chunk (run
+// in parallel) tracks whether we are in a string or a comment, which tells us
+// which cut points land inside a string literal; those are dropped. Each
+// remaining chunk is scanned on its own thread and the results are spliced
+// back together. Lines come from TokenBuffer's newline index, so there's
+// nothing to correct afterwards.
+//
+// `threads` of zero means one per hardware thread. Scan errors are still
+// reported, but chunks report theirs concurrently so the ordering between
+// chunks isn't fixed.
+TokenBuffer tokenise_parallel(absl::string_view source, unsigned threads = 0);
+
+} // namespace lox
+
+#endif // LOX_PARALLELSCANNER_HPP
@@ -1,13 +1,39 @@
 #include "Parser.hpp"
 #include "Error.hpp"
+#include "Optimiser.hpp"
+#include "Scanner.hpp"
 #include "Utils.hpp"
 
 #include <fmt/format.h>
 
 #include <initializer_list>
+#include <utility>
 
 namespace lox {
 
+namespace {
+
+// Sets a variable for as long as it is in scope, errors included
+template <typename T>
+class Restore {
+  T &var_;
+  T old_;
+
+ public:
+  Restore(T &var, T value)
+      : var_(var)
+      , old_(std::exchange(var, value)) {}
+  ~Restore() { var_ = old_; }
+};
+
+} // namespace
+
+bool Parser::match(TokenType type) {
+  if (!check(type)) { return false; }
+  advance();
+  return true;
+}
+
 bool Parser::match(const TokenTypeList &types) {
   for (auto type : types) {
     if (check(type)) {
@@ -43,13 +69,62 @@ void Parser::sync() {
 }
 
 StatementsList Parser::block() {
-  StatementsList stmts;
-  while (!check(TokenType::R_BRACE) && !at_end())
-    stmts.push_back(std::move(declaration()));
+  auto stmts = block_contents();
   consume(TokenType::R_BRACE, "Expected '}' after block statement");
   return stmts;
 }
 
+StatementsList Parser::block_contents() {
+  ListBuilder<StmtPtr> stmts;
+  while (!check(TokenType::R_BRACE) && !at_end()) {
+    // Statements that failed to parse have already been reported
+    if (auto decl = declaration()) { stmts.push_back(decl); }
+  }
+  return arena_.list(absl::MakeConstSpan(stmts));
+}
+
+// Finds the end of a function body by counting braces, without building
+// anything. The scanner still sees every token, so lexical errors are
+// reported straight away; syntax errors wait until the body is parsed.
+LazyBody *Parser::skip_body() {
+  using enum TokenType;
+  auto open  = prev();
+  auto depth = 1;
+  while (depth > 0) {
+    if (at_end()) {
+      throw ParseError("Expected '}' after block statement",
+                       peek().location());
+    }
+    auto &tok = advance();
+    depth += tok.type() == L_BRACE ? 1 : tok.type() == R_BRACE ? -1 : 0;
+  }
+  // Token offsets are one past the end of their lexeme in the source
+  auto source = open.lexeme().data() + 1 - open.offset();
+  return arena_.make<LazyBody>(source, open.offset(), prev().offset(),
+                               open.line(), &arena_, false);
+}
+
+// skip_body() has reported any lexical errors already. Syntax errors are
+// reported here, as they are anywhere else, and the function keeps whatever
+// did parse: nothing may throw past here into the running program.
+void Parser::parse_body(Fn &fn) {
+  auto lazy = std::exchange(fn.lazy_, nullptr);
+  if (!lazy) { return; }
+  Scanner scanner(absl::string_view(lazy->source, lazy->end));
+  scanner.start_at(lazy->begin, lazy->line).quietly();
+  Parser parser(scanner, *lazy->arena, true);
+  parser.in_function_ = true;
+  fn.statements_      = parser.block_contents();
+  try {
+    parser.consume(TokenType::R_BRACE, "Expected '}' after block statement");
+  } catch (const ParseError &pe) {
+    report_error(pe.what(), Location{}.chr(parser.current_));
+  }
+  if (lazy->optimise) {
+    fn.statements_ = Optimiser(*lazy->arena).optimise(fn.statements_);
+  }
+}
+
 StmtPtr Parser::declaration() {
   try {
     if (match({TokenType::FUN})) { return function(FunctionKind::FUNC); }
@@ -66,7 +141,7 @@ StmtPtr Parser::var_declaration() {
   auto name        = consume(TokenType::IDENT, "Expected variable name");
   auto initialiser = match({TokenType::EQ}) ? expression() : nullptr;
   consume(TokenType::SEMICOLON, "Expected ';' after variable declaration");
-  return std::make_shared<Var>(name, initialiser);
+  return arena_.make<Var>(name, initialiser);
 }
 
 StmtPtr Parser::statement() {
@@ -78,11 +153,12 @@ StmtPtr Parser::statement() {
     consume(R_PAREN, "Expected ')' after if condition.");
     auto then    = statement();
     auto else_br = match({ELSE}) ? statement() : nullptr;
-    return std::make_shared<If>(cond, then, else_br);
+    return arena_.make<If>(cond, then, else_br);
   }
   if (match({WHILE})) return while_stmt();
-  if (match({L_BRACE}))
-    return std::shared_ptr<Block>(new Block(std::move(block())));
+  if (match({RETURN})) return return_stmt();
+  if (match({BREAK, CONTINUE})) return jump_stmt();
+  if (match({L_BRACE})) return arena_.make<Block>(block());
   return exprstmt();
 }
 
@@ -106,15 +182,12 @@ StmtPtr Parser::for_stmt() {
   ExprPtr increment = nullptr;
   if (!check(R_PAREN)) increment = expression();
   consume(R_PAREN, "Expected ')' after for loop clauses.");
-  StmtPtr body = statement();
+  StmtPtr body = loop_body();
 
-  if (increment) {
-    body = std::make_shared<Block>(
-        StatementsList({body, std::make_shared<Expression>(increment)}));
-  }
-  if (!condition) condition = std::make_shared<BoolLiteral>(true);
-  body = std::make_shared<While>(condition, body);
-  if (init) body = std::make_shared<Block>(StatementsList({init, body}));
+  // The increment stays apart from the body so that `continue` still runs it
+  if (!condition) condition = arena_.make<BoolLiteral>(true);
+  body = arena_.make<While>(condition, body, increment);
+  if (init) body = arena_.make<Block>(arena_.list<StmtPtr>({init, body}));
 
   return body;
 }
@@ -134,7 +207,7 @@ StmtPtr Parser::function(FunctionKind kind) {
   auto name_str = name.identifier();
   consume(L_PAREN, fmt::format("Expected '(' after {} identifier (name {}).",
                                kind_str, name_str));
-  TokensList params;
+  ListBuilder<Token> params;
   if (!check(R_PAREN)) {
     do {
       if (params.size() >= 255)
@@ -148,189 +221,199 @@ StmtPtr Parser::function(FunctionKind kind) {
           fmt::format("Expected ')' after {} parameter list.", name_str));
   consume(L_BRACE,
           fmt::format("Expected '{{' before {} {} body.", kind_str, name_str));
-  auto body = block();
-  return std::make_shared<Fn>(name, params, body);
+  auto params_list = arena_.list(absl::MakeConstSpan(params));
+  if (lazy_functions_) {
+    return arena_.make<Fn>(name, params_list, StatementsList{}, skip_body());
+  }
+  // Loops around the function have nothing to do with its body
+  Restore in_function(in_function_, true);
+  Restore loops(loops_, 0);
+  return arena_.make<Fn>(name, params_list, block(), nullptr);
+}
+
+StmtPtr Parser::loop_body() {
+  Restore loops(loops_, loops_ + 1);
+  return statement();
+}
+
+StmtPtr Parser::return_stmt() {
+  if (!in_function_) {
+    throw ParseError("Can't return from top-level code.", prev().location());
+  }
+  auto value = check(TokenType::SEMICOLON) ? nullptr : expression();
+  consume(TokenType::SEMICOLON, "Expected ';' after return value.");
+  return arena_.make<Return>(value);
+}
+
+StmtPtr Parser::jump_stmt() {
+  auto keyword = prev();
+  if (loops_ == 0) {
+    throw ParseError(
+        fmt::format("Can't use '{}' outside of a loop.", keyword.lexeme()),
+        keyword.location());
+  }
+  consume(TokenType::SEMICOLON,
+          fmt::format("Expected ';' after '{}'.", keyword.lexeme()));
+  if (keyword.type() == TokenType::BREAK) { return arena_.make<Break>(); }
+  return arena_.make<Continue>();
 }
 
 StmtPtr Parser::while_stmt() {
   consume(TokenType::L_PAREN, "Expected '(' after 'while'.");
   auto cond = expression();
   consume(TokenType::R_PAREN, "Expected ')' after while condition.");
-  auto body = statement();
-  return std::make_shared<While>(cond, body);
+  auto body = loop_body();
+  return arena_.make<While>(cond, body, nullptr);
 }
 
 StmtPtr Parser::exprstmt() {
   auto expr = expression();
   consume(TokenType::SEMICOLON, "Expected `;` after expression");
-  return std::make_shared<Expression>(expr);
+  return arena_.make<Expression>(expr);
 }
 
-ExprPtr Parser::expression() { return assignment(); }
-
-ExprPtr Parser::assignment() {
-  auto expr = comma();
-
-  if (match({TokenType::EQ})) {
-    auto eq  = prev();
-    auto val = assignment();
-
-    if (auto var = dynamic_cast<Variable *>(expr.get())) {
-      auto name = var->name_;
-      return std::make_shared<Assign>(name, val);
-    }
-    report_error("Invalid assignment target.", Location{});
-  }
-  return expr;
+ExprPtr Parser::expression() {
+  return parse_precedence(Precedence::ASSIGNMENT);
 }
 
-ExprPtr Parser::comma() {
-  auto expr = or_expr();
-  // Use short-circuit evaluation so we don't eat the comma
-  while (!parsing_args_ && match({TokenType::COMMA})) {
-    auto op    = prev();
-    auto right = equality();
-    expr       = std::make_shared<Binary>(expr, right, op);
-  }
-  return expr;
+const Parser::Rule &Parser::rule(TokenType type) {
+  // Precedence and TokenType share a few names (AND, OR, COMMA), so neither
+  // gets a using-enum here
+  using P = Precedence;
+  using T = TokenType;
+  static constexpr auto rules = [] {
+    std::array<Rule, token_type_count> r{};
+    auto set = [&r](T t, Rule rule) { r[static_cast<int>(t)] = rule; };
+    auto binary = [](P p, P operand) {
+      return Rule{nullptr, &Parser::binary, p, operand, p};
+    };
+    auto logical = [](P p, P operand) {
+      return Rule{nullptr, &Parser::logical, p, operand, p};
+    };
+
+    set(T::L_PAREN, {&Parser::grouping, &Parser::call, P::CALL, P::NONE,
+                     P::CALL});
+    set(T::EQ, {nullptr, &Parser::assign, P::ASSIGNMENT, P::ASSIGNMENT,
+                P::ASSIGNMENT});
+    set(T::COMMA, binary(P::COMMA, P::EQUALITY));
+    set(T::OR, logical(P::OR, P::AND));
+    set(T::AND, logical(P::AND, P::TERNARY));
+    set(T::QUESTION,
+        {nullptr, &Parser::ternary, P::TERNARY, P::EQUALITY, P::AND});
+    set(T::BANG_EQ, binary(P::EQUALITY, P::COMPARISON));
+    set(T::EQ_EQ, binary(P::EQUALITY, P::COMPARISON));
+    set(T::GTR, binary(P::COMPARISON, P::TERM));
+    set(T::GTR_EQ, binary(P::COMPARISON, P::TERM));
+    set(T::LESS, binary(P::COMPARISON, P::TERM));
+    set(T::LESS_EQ, binary(P::COMPARISON, P::TERM));
+    set(T::PLUS, binary(P::TERM, P::FACTOR));
+    set(T::MINUS,
+        {&Parser::unary, &Parser::binary, P::TERM, P::FACTOR, P::TERM});
+    set(T::SLASH, binary(P::FACTOR, P::UNARY));
+    set(T::STAR, binary(P::FACTOR, P::UNARY));
+    set(T::BANG, {&Parser::unary});
+    for (auto t : {T::FALSE, T::TRUE, T::NIL, T::NUMBER, T::STRING, T::IDENT})
+      set(t, {&Parser::literal});
+    return r;
+  }();
+  return rules[static_cast<int>(type)];
 }
 
-ExprPtr Parser::or_expr() {
-  auto expr = and_expr();
-  while (match({TokenType::OR})) {
-    auto op    = prev();
-    auto right = and_expr();
-    expr       = std::make_shared<Logical>(expr, right, op);
-  }
-  return expr;
-}
+ExprPtr Parser::parse_precedence(Precedence min) {
+  auto prefix = rule(peek().type()).prefix;
+  if (!prefix) { throw ParseError("Expected expression", peek().location()); }
+  advance();
+  auto expr    = (this->*prefix)();
+  auto ceiling = Precedence::PRIMARY;
 
-ExprPtr Parser::and_expr() {
-  auto expr = ternary();
-  while (match({TokenType::AND})) {
-    auto op    = prev();
-    auto right = ternary();
-    expr       = std::make_shared<Logical>(expr, right, op);
+  while (true) {
+    auto type  = peek().type();
+    auto &next = rule(type);
+    // Inside an argument list a comma separates arguments instead
+    auto prec = type == TokenType::COMMA && parsing_args_ ? Precedence::NONE
+                                                          : next.precedence;
+    if (!next.infix || prec < min || prec > ceiling) { break; }
+    advance();
+    expr    = (this->*next.infix)(expr);
+    ceiling = next.ceiling;
   }
   return expr;
 }
 
-ExprPtr Parser::ternary() {
-  using enum TokenType;
-  auto cond = equality();
-  if (match({QUESTION})) {
-    auto left = equality();
-    consume(COLON, "Expected ':' to match '?' in ternary expr");
-    auto right = equality();
-    return std::make_shared<Ternary>(cond, left, right);
-  }
-  return cond;
-}
-
-// TODO: make these all one instance of a template somehow? Or preprocessor?
-ExprPtr Parser::equality() {
-  auto expr = comparison();
-  while (match({TokenType::BANG_EQ, TokenType::EQ_EQ})) {
-    auto op    = prev();
-    auto right = comparison();
-    expr       = std::make_shared<Binary>(expr, right, op);
-  }
-  return expr;
+ExprPtr Parser::grouping() {
+  auto expr = expression();
+  consume(TokenType::R_PAREN, "Expected ')' after expression to match '('");
+  return arena_.make<Group>(expr);
 }
 
-ExprPtr Parser::comparison() {
+ExprPtr Parser::literal() {
   using enum TokenType;
-  auto expr = term();
-  while (match({GTR, GTR_EQ, LESS, LESS_EQ})) {
-    auto op    = prev();
-    auto right = term();
-    expr       = std::make_shared<Binary>(expr, right, op);
+  auto &tok = prev();
+  switch (tok.type()) {
+  case FALSE: return arena_.make<BoolLiteral>(false);
+  case TRUE: return arena_.make<BoolLiteral>(true);
+  case NIL: return arena_.make<NullLiteral>();
+  case NUMBER: return arena_.make<NumLiteral>(tok.number());
+  // The literal's text stays a view into the source, which lives as long as
+  // the arena does
+  case STRING: return arena_.make<StrLiteral>(tok.string());
+  case IDENT: return arena_.make<Variable>(tok);
+  default: util::unreachable();
   }
-  return expr;
 }
 
-ExprPtr Parser::term() {
-  auto expr = factor();
-  while (match({TokenType::MINUS, TokenType::PLUS})) {
-    auto op    = prev();
-    auto right = factor();
-    expr       = std::make_shared<Binary>(expr, right, op);
-  }
-  return expr;
+ExprPtr Parser::unary() {
+  auto op    = prev();
+  auto right = parse_precedence(Precedence::UNARY);
+  return arena_.make<Unary>(right, op);
 }
 
-ExprPtr Parser::factor() {
-  auto expr = unary();
-  while (match({TokenType::SLASH, TokenType::STAR})) {
-    auto op    = prev();
-    auto right = unary();
-    expr       = std::make_shared<Binary>(expr, right, op);
+ExprPtr Parser::assign(ExprPtr target) {
+  auto val = parse_precedence(Precedence::ASSIGNMENT);
+  if (auto var = dynamic_cast<Variable *>(target)) {
+    return arena_.make<Assign>(var->name_, val);
   }
-  return expr;
+  report_error("Invalid assignment target.", Location{});
+  return target;
 }
 
-ExprPtr Parser::unary() {
-  if (match({TokenType::BANG, TokenType::MINUS})) {
-    auto op    = prev();
-    auto right = unary();
-    return std::make_shared<Unary>(right, op);
-  }
-  return call();
+ExprPtr Parser::binary(ExprPtr left) {
+  auto op    = prev();
+  auto right = parse_precedence(rule(op.type()).operand);
+  return arena_.make<Binary>(left, right, op);
 }
 
-ExprPtr Parser::call() {
-  ExprPtr expr = primary();
-
-  auto get_args = [this](ExprPtr callee) {
-    using enum TokenType;
-    ExpressionsList args;
-    bool already_reported = false;
-    parsing_args_         = true;
-    if (!check(R_PAREN)) {
-      do {
-        if (args.size() >= 255 && !already_reported) {
-          report_error("Functions must not exceed 255 arguments.", Location{});
-          already_reported = true;
-        }
-        args.push_back(expression());
-      } while (match({COMMA}));
-    }
-    parsing_args_ = false;
-    auto paren    = consume(R_PAREN, "Expected ')' after argument list.");
-    return std::make_shared<Call>(callee, paren, args);
-  };
+ExprPtr Parser::logical(ExprPtr left) {
+  auto op    = prev();
+  auto right = parse_precedence(rule(op.type()).operand);
+  return arena_.make<Logical>(left, right, op);
+}
 
-  while (true) {
-    if (match({TokenType::L_PAREN})) {
-      expr = get_args(expr);
-    } else {
-      break;
-    }
-  }
-  return expr;
+ExprPtr Parser::ternary(ExprPtr cond) {
+  auto left = parse_precedence(Precedence::EQUALITY);
+  consume(TokenType::COLON, "Expected ':' to match '?' in ternary expr");
+  auto right = parse_precedence(Precedence::EQUALITY);
+  return arena_.make<Ternary>(cond, left, right);
 }
 
-ExprPtr Parser::primary() {
+ExprPtr Parser::call(ExprPtr callee) {
   using enum TokenType;
-  if (match({FALSE})) { return std::make_shared<BoolLiteral>(false); }
-  if (match({TRUE})) { return std::make_shared<BoolLiteral>(true); }
-  if (match({NIL})) { return std::make_shared<NullLiteral>(); }
-  if (match({NUMBER})) { return std::make_shared<NumLiteral>(prev().number()); }
-  // TODO: change this to clarify ownership, what will live longest? Probably
-  // the expression node so string should live in it, views everywhere else
-  if (match({STRING})) {
-    return std::make_shared<StrLiteral>(std::string(prev().string()));
-  }
-
-  if (match({IDENT})) { return std::make_shared<Variable>(prev()); }
-
-  if (match({L_PAREN})) {
-    auto expr = expression();
-    consume(R_PAREN, "Expected ')' after expression to match '('");
-    return std::make_shared<Group>(expr);
+  ListBuilder<ExprPtr> args;
+  bool already_reported = false;
+  if (!check(R_PAREN)) {
+    // Until the end of this call's arguments, not of the first nested call's
+    Restore parsing_args(parsing_args_, true);
+    do {
+      if (args.size() >= 255 && !already_reported) {
+        report_error("Functions must not exceed 255 arguments.", Location{});
+        already_reported = true;
+      }
+      args.push_back(expression());
+    } while (match(COMMA));
   }
-
-  throw ParseError("Expected expression", tokens_[current_].location());
+  auto paren = consume(R_PAREN, "Expected ')' after argument list.");
+  return arena_.make<Call>(callee, paren,
+                           arena_.list(absl::MakeConstSpan(args)));
 }
 
 } // namespace lox
@@ -1,54 +1,140 @@
 #ifndef LOX_PARSER_HPP
 #define LOX_PARSER_HPP
 
+#include "Arena.hpp"
 #include "Expr.hpp"
 #include "Stmt.hpp"
 #include "Token.hpp"
+#include "TokenSource.hpp"
 #include "Utils.hpp"
 
 #include <absl/container/inlined_vector.h>
 
+#include <array>
+#include <cstdint>
 #include <memory>
 
 namespace lox {
 
 using TokenTypeList = absl::InlinedVector<lox::TokenType, 4>;
 
+// Lists are gathered here while parsing, then copied into the arena once
+// their final size is known
+template <typename T>
+using ListBuilder = absl::InlinedVector<T, 8>;
+
+// A function body the parser only skipped over. `source` is the start of the
+// text the function came from, and the body runs from just after its '{' at
+// `begin` up to and including the matching '}' at `end - 1`. The source and
+// `arena` both belong to the unit that defined the function, so they are
+// still around whenever it gets called. `optimise` is set by the Optimiser
+// when it comes across the function, asking for the body to get the same
+// treatment once it has been parsed.
+struct LazyBody {
+  const char *source;
+  size_t begin;
+  size_t end;
+  int line;
+  Arena *arena;
+  bool optimise;
+};
+
 class Parser {
   enum class FunctionKind { FUNC, METHOD };
 
-  std::vector<Token> tokens_;
-  int current_;
+  // Binding power of each infix operator, loosest first
+  enum class Precedence : uint8_t {
+    NONE,
+    ASSIGNMENT, // =
+    COMMA,      // ,
+    OR,         // or
+    AND,        // and
+    TERNARY,    // ?:
+    EQUALITY,   // == !=
+    COMPARISON, // < > <= >=
+    TERM,       // + -
+    FACTOR,     // * /
+    UNARY,      // ! -
+    CALL,       // ()
+    PRIMARY
+  };
+
+  using PrefixFn = ExprPtr (Parser::*)();
+  using InfixFn  = ExprPtr (Parser::*)(ExprPtr);
+
+  // How to parse an expression starting with, or continuing at, a token.
+  // `operand` is what the right hand side is parsed at, and `ceiling` is the
+  // tightest operator allowed to follow. Together they reproduce the old
+  // recursive-descent grammar exactly, quirks included: comma and ternary
+  // operands are parsed at equality level and ternaries don't chain.
+  struct Rule {
+    PrefixFn prefix       = nullptr;
+    InfixFn infix         = nullptr;
+    Precedence precedence = Precedence::NONE;
+    Precedence operand    = Precedence::NONE;
+    Precedence ceiling    = Precedence::NONE;
+  };
+
+  static const Rule &rule(TokenType);
+
+  // Tokens are pulled from the source on demand. The parser only ever looks
+  // at the current token and the one before it, so a small ring is all we
+  // keep; a couple of spare slots let callers hold on to a returned
+  // reference for a few more advances.
+  static constexpr size_t ring_size_ = 4;
+  static_assert((ring_size_ & (ring_size_ - 1)) == 0);
+
+  TokenSource &source_;
+  Arena &arena_;
+  std::array<Token, ring_size_> ring_;
+  size_t current_;
   bool parsing_args_;
+  // Only match braces over function bodies, and parse them on first call
+  bool lazy_functions_;
+  // Where `return`, `break` and `continue` make sense: inside a function, and
+  // inside a loop in the same function
+  bool in_function_ = false;
+  int loops_        = 0;
 
-  ExprPtr and_expr();
-  ExprPtr assignment();
-  ExprPtr call();
-  ExprPtr comma();
-  ExprPtr comparison();
-  ExprPtr equality();
   ExprPtr expression();
-  ExprPtr factor();
-  ExprPtr or_expr();
-  ExprPtr primary();
-  ExprPtr term();
-  ExprPtr ternary();
+  ExprPtr parse_precedence(Precedence);
+
+  ExprPtr grouping();
+  ExprPtr literal();
   ExprPtr unary();
 
+  ExprPtr assign(ExprPtr);
+  ExprPtr binary(ExprPtr);
+  ExprPtr call(ExprPtr);
+  ExprPtr logical(ExprPtr);
+  ExprPtr ternary(ExprPtr);
+
   StatementsList block();
+  // The declarations up to a block's closing brace, which is left unread
+  StatementsList block_contents();
+  LazyBody *skip_body();
   StmtPtr declaration();
   StmtPtr exprstmt();
   StmtPtr for_stmt();
   StmtPtr function(FunctionKind);
+  StmtPtr jump_stmt();
+  StmtPtr loop_body();
+  StmtPtr return_stmt();
   StmtPtr statement();
   StmtPtr var_declaration();
   StmtPtr while_stmt();
 
   const Token &consume(TokenType, absl::string_view);
+  bool match(TokenType);
   bool match(const TokenTypeList &);
   void sync();
 
-  const Token &advance() { return tokens_[at_end() ? current_ : current_++]; }
+  const Token &advance() {
+    if (at_end()) { return peek(); }
+    current_++;
+    ring_[current_ % ring_size_] = source_.next_token();
+    return prev();
+  }
 
   bool at_end() const { return peek().type() == TokenType::EOF; }
 
@@ -57,26 +143,43 @@ class Parser {
     return peek().type() == type;
   }
 
-  const Token &peek() const { return tokens_[current_]; }
+  const Token &peek() const { return ring_[current_ % ring_size_]; }
 
   const Token &prev() const {
     ABSL_ASSERT(current_ != 0);
-    return tokens_[current_ - 1];
+    return ring_[(current_ - 1) % ring_size_];
   }
 
  public:
-  Parser(std::vector<Token> &&tokens)
-      : tokens_(tokens)
+  // Every node is allocated in `arena`, which must outlive the tree
+  Parser(TokenSource &source, Arena &arena, bool lazy_functions = false)
+      : source_(source)
+      , arena_(arena)
+      , ring_{}
       , current_(0)
-      , parsing_args_{false} {}
+      , parsing_args_{false}
+      , lazy_functions_{lazy_functions} {
+    ring_[0] = source_.next_token();
+  }
+
+  // Parses the body of a function that was skipped over, if it hasn't been
+  // already. Functions nested inside it are left lazy in turn.
+  static void parse_body(Fn &);
+
+  // For callers that want to see where each top-level declaration ends: one
+  // declaration at a time (nullptr if it failed to parse and was skipped),
+  // until done(). position() is one past the end of the last token used.
+  StmtPtr parse_declaration() { return declaration(); }
+  bool done() const { return at_end(); }
+  size_t position() const { return current_ == 0 ? 0 : prev().offset(); }
 
   StatementsList parse() {
-    StatementsList statements;
+    ListBuilder<StmtPtr> statements;
     while (!at_end()) {
       auto decl = declaration();
-      if (decl) statements.push_back(std::move(decl));
+      if (decl) statements.push_back(decl);
     }
-    return statements;
+    return arena_.list(absl::MakeConstSpan(statements));
   }
 };
 
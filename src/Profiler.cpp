@@ -0,0 +1,101 @@
+#include "Profiler.hpp"
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/strings/str_cat.h>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <signal.h>
+#include <sys/time.h>
+
+namespace lox {
+
+namespace {
+
+constexpr suseconds_t interval_us = 1000;
+
+constexpr absl::string_view program = "<script>";
+
+} // namespace
+
+Profiler::Profiler()
+    // Left uninitialised, so only the pages samples are written to are ever
+    // touched
+    : samples_(new Frame[capacity]) {}
+
+void Profiler::start() {
+  thread_ = pthread_self();
+  depth_.store(0, std::memory_order_relaxed);
+  enter(program, 0);
+  running_ = this;
+
+  struct sigaction action = {};
+  action.sa_handler = &Profiler::on_signal;
+  action.sa_flags   = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, nullptr);
+
+  itimerval timer = {};
+  timer.it_interval.tv_usec = interval_us;
+  timer.it_value.tv_usec    = interval_us;
+  setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+void Profiler::stop() {
+  itimerval timer = {};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  signal(SIGPROF, SIG_IGN);
+  running_ = nullptr;
+}
+
+void Profiler::on_signal(int) {
+  auto *profiler = running_;
+  if (profiler && pthread_equal(pthread_self(), profiler->thread_)) {
+    profiler->sample();
+  }
+}
+
+// Runs in the signal handler, so takes no locks and allocates nothing
+void Profiler::sample() {
+  auto depth = std::min(depth_.load(std::memory_order_relaxed), max_depth);
+  std::atomic_signal_fence(std::memory_order_acquire);
+  if (used_ + 1 + depth > capacity) {
+    dropped_++;
+    return;
+  }
+  samples_[used_] = Frame{nullptr, static_cast<uint32_t>(depth), 0};
+  std::copy(stack_, stack_ + depth, &samples_[used_ + 1]);
+  used_ += 1 + depth;
+}
+
+uint64_t Profiler::write(std::FILE *out) const {
+  absl::flat_hash_map<std::string, uint64_t> counts;
+  uint64_t samples = 0;
+  std::string frames;
+  for (size_t at = 0; at < used_; samples++) {
+    auto depth = samples_[at++].length;
+    frames.clear();
+    for (auto *frame = &samples_[at]; frame != &samples_[at + depth]; frame++) {
+      if (!frames.empty()) { frames += ';'; }
+      frames.append(frame->name, frame->length);
+      if (frame->line) { absl::StrAppend(&frames, ":", frame->line); }
+    }
+    at += depth;
+    counts[frames]++;
+  }
+  // In order, so that profiles of the same run can be compared
+  std::vector<std::pair<std::string, uint64_t>> sorted(counts.begin(),
+                                                       counts.end());
+  std::sort(sorted.begin(), sorted.end());
+  for (auto &[stack, count] : sorted) {
+    fmt::print(out, "{} {}\n", stack, count);
+  }
+  return samples;
+}
+
+} // namespace lox
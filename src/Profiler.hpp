@@ -0,0 +1,105 @@
+#ifndef LOX_PROFILER_HPP
+#define LOX_PROFILER_HPP
+
+#include <absl/strings/string_view.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <pthread.h>
+
+namespace lox {
+
+// Samples the shadow stack of Lox calls on SIGPROF, and writes the stacks
+// seen in the collapsed format flamegraph.pl reads
+class Profiler {
+ public:
+  struct Frame {
+    // Into the source, which outlives the session
+    const char *name;
+    uint32_t length;
+    uint32_t line;
+  };
+
+  static constexpr size_t max_depth = 512;
+  // Frames in all the samples together, sample headers included
+  static constexpr size_t capacity = size_t{1} << 20;
+
+ private:
+  inline static Profiler *running_ = nullptr;
+
+  Frame stack_[max_depth];
+  std::atomic<size_t> depth_{0};
+  // Each sample is a header, whose length is its depth, then its frames
+  std::unique_ptr<Frame[]> samples_;
+  size_t used_      = 0;
+  uint64_t dropped_ = 0;
+  pthread_t thread_;
+
+  static void on_signal(int);
+  void sample();
+  void set(size_t at, absl::string_view name, int line) {
+    if (at < max_depth) {
+      stack_[at] = Frame{name.data(), static_cast<uint32_t>(name.size()),
+                         static_cast<uint32_t>(line)};
+    }
+  }
+
+ public:
+  Profiler();
+  Profiler(const Profiler &)            = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  // The profiler sampling this session, if any
+  static Profiler *running() { return running_; }
+
+  // Starts the timer, with only the program itself on the stack
+  void start();
+  void stop();
+
+  // The depth is only raised once the frame is written
+  void enter(absl::string_view name, int line) {
+    auto depth = depth_.load(std::memory_order_relaxed);
+    set(depth, name, line);
+    std::atomic_signal_fence(std::memory_order_release);
+    depth_.store(depth + 1, std::memory_order_relaxed);
+  }
+  void leave() { depth_.fetch_sub(1, std::memory_order_relaxed); }
+  // The innermost function making a tail call to another
+  void replace(absl::string_view name, int line) {
+    leave();
+    std::atomic_signal_fence(std::memory_order_release);
+    enter(name, line);
+  }
+
+  // Returns how many samples there were
+  uint64_t write(std::FILE *) const;
+  uint64_t dropped() const { return dropped_; }
+};
+
+// A call the running profiler, if any, sees for as long as this lives
+class ProfiledCall {
+  Profiler *profiler_;
+
+ public:
+  ProfiledCall(absl::string_view name, int line)
+      : profiler_(Profiler::running()) {
+    if (profiler_) { profiler_->enter(name, line); }
+  }
+  ~ProfiledCall() {
+    if (profiler_) { profiler_->leave(); }
+  }
+  ProfiledCall(const ProfiledCall &)            = delete;
+  ProfiledCall &operator=(const ProfiledCall &) = delete;
+
+  void replace(absl::string_view name, int line) {
+    if (profiler_) { profiler_->replace(name, line); }
+  }
+};
+
+} // namespace lox
+
+#endif // LOX_PROFILER_HPP
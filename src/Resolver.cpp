@@ -0,0 +1,139 @@
+#include "Resolver.hpp"
+
+#include <utility>
+
+namespace lox {
+
+namespace {
+
+// Declarations only ever appear directly in a list of statements, so this is
+// how many slots the scope around the list needs
+uint32_t count_declarations(StatementsList stmts) {
+  uint32_t count = 0;
+  for (auto stmt : stmts) {
+    count += dynamic_cast<Var *>(stmt) || dynamic_cast<Fn *>(stmt);
+  }
+  return count;
+}
+
+} // namespace
+
+void Resolver::resolve_program(StatementsList stmts) { resolve(stmts); }
+
+void Resolver::resolve_function(Fn &f) {
+  if (f.lazy_) { return; }
+  // Nothing from outside the function is in sight but the globals
+  auto outer = std::exchange(scopes_, {});
+  scopes_.emplace_back();
+  for (auto &param : f.tokens_) { declare(param.lexeme()); }
+  resolve(f.statements_);
+  f.slots_ = scopes_.back().slots;
+  scopes_  = std::move(outer);
+}
+
+void Resolver::resolve(StatementsList stmts) {
+  for (auto stmt : stmts) { resolve(stmt); }
+}
+
+Binding Resolver::declare(absl::string_view name) {
+  if (scopes_.empty()) { return Binding{Binding::global, globals_.slot(name)}; }
+  auto &scope = scopes_.back();
+  auto slot   = scope.slots++;
+  scope.names.try_emplace(name, slot);
+  return Binding{0, slot};
+}
+
+Binding Resolver::lookup(absl::string_view name) {
+  for (size_t depth = 0; depth < scopes_.size(); depth++) {
+    auto &names = scopes_[scopes_.size() - 1 - depth].names;
+    if (auto elem = names.find(name); elem != names.end()) {
+      return Binding{static_cast<uint32_t>(depth), elem->second};
+    }
+  }
+  return Binding{Binding::global, globals_.slot(name)};
+}
+
+void Resolver::visitAssignExpr(Assign &a) {
+  resolve(a.val_);
+  a.binding_ = lookup(a.name_.identifier());
+}
+
+void Resolver::visitBinaryExpr(Binary &b) {
+  resolve(b.left_);
+  resolve(b.right_);
+}
+
+void Resolver::visitTernaryExpr(Ternary &t) {
+  auto tail = tail_;
+  resolve(t.cond_);
+  resolve(t.left_, tail);
+  resolve(t.right_, tail);
+}
+
+void Resolver::visitCallExpr(Call &c) {
+  c.tail_ = tail_;
+  resolve(c.callee_);
+  for (auto arg : c.args_) { resolve(arg); }
+}
+
+void Resolver::visitGroupExpr(Group &g) { resolve(g.expr_, tail_); }
+
+void Resolver::visitLogicalExpr(Logical &l) {
+  auto tail = tail_;
+  resolve(l.left_);
+  resolve(l.right_, tail);
+}
+
+void Resolver::visitVariableExpr(Variable &v) {
+  v.binding_ = lookup(v.name_.identifier());
+}
+
+void Resolver::visitUnaryExpr(Unary &u) { resolve(u.right_); }
+
+// Interned strings are pinned, as the tree outlives anything it runs
+void Resolver::visitStrLiteralExpr(StrLiteral &s) {
+  if (!s.interned_) { s.interned_ = String::intern(s.value_); }
+}
+
+void Resolver::visitBlockStmt(Block &b) {
+  b.slots_ = count_declarations(b.statements_);
+  if (b.slots_ == 0) {
+    resolve(b.statements_);
+    return;
+  }
+  scopes_.emplace_back();
+  resolve(b.statements_);
+  scopes_.pop_back();
+}
+
+void Resolver::visitExpressionStmt(Expression &e) { resolve(e.expression_); }
+
+void Resolver::visitFnStmt(Fn &f) {
+  f.binding_ = declare(f.name_.lexeme());
+  resolve_function(f);
+}
+
+void Resolver::visitIfStmt(If &i) {
+  resolve(i.condition_);
+  resolve(i.then_);
+  if (i.else_br_) { resolve(i.else_br_); }
+}
+
+void Resolver::visitWhileStmt(While &w) {
+  resolve(w.condition_);
+  resolve(w.body_);
+  if (w.increment_) { resolve(w.increment_); }
+}
+
+// The initialiser runs before the variable exists, so any use of the name in
+// it means whatever it meant before
+void Resolver::visitVarStmt(Var &v) {
+  if (v.initialiser_) { resolve(v.initialiser_); }
+  v.binding_ = declare(v.name_.identifier());
+}
+
+void Resolver::visitReturnStmt(Return &r) {
+  if (r.value_) { resolve(r.value_, tail_calls_); }
+}
+
+} // namespace lox
@@ -0,0 +1,99 @@
+#ifndef LOX_RESOLVER_HPP
+#define LOX_RESOLVER_HPP
+
+#include "Environment.hpp"
+#include "Expr.hpp"
+#include "Stmt.hpp"
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/inlined_vector.h>
+#include <absl/strings/string_view.h>
+
+#include <cstdint>
+
+namespace lox {
+
+// Works out, before anything runs, where every variable lives: which scope
+// out from the current one, and which slot within it, or which global slot.
+// The interpreter then goes straight to the slot instead of searching scopes
+// by name.
+//
+// This follows what the interpreter always did at run time. A function sees
+// its own parameters and variables and the globals, and nothing of the
+// scopes it was defined or called in. A name declared twice in one scope
+// keeps its first value; the second declaration gets a slot of its own that
+// nothing reads. Blocks that declare nothing get no scope at all.
+//
+// Global slots come from the interpreter's table, so they stay the same
+// across everything run in a session.
+//
+// String literals are interned on the way, so running one hands out the same
+// String every time instead of making a new one.
+//
+// A call whose result a return gives back as it is, directly or as a branch
+// of `?:`, the right operand of `and`/`or` or in parentheses, is in tail
+// position, and unless tail calls are turned off it is marked as such:
+// nothing is left to do in the function once the callee is known, so the
+// engines can run it in the returning function's frame.
+class Resolver
+    : expr::Visitor<void>
+    , stmt::Visitor<void> {
+  struct Scope {
+    absl::flat_hash_map<absl::string_view, uint32_t> names;
+    uint32_t slots = 0;
+  };
+
+  Globals &globals_;
+  bool tail_calls_;
+  // Whether the expression being resolved is in tail position
+  bool tail_ = false;
+  // Innermost last, and only those of the function being resolved
+  absl::InlinedVector<Scope, 8> scopes_;
+
+  void resolve(ExprPtr expr, bool tail = false) {
+    tail_ = tail;
+    expr->accept(*this);
+  }
+  void resolve(StmtPtr stmt) { stmt->accept(*this); }
+  void resolve(StatementsList);
+  Binding declare(absl::string_view name);
+  Binding lookup(absl::string_view name);
+
+  void visitAssignExpr(Assign &) override;
+  void visitBinaryExpr(Binary &) override;
+  void visitTernaryExpr(Ternary &) override;
+  void visitCallExpr(Call &) override;
+  void visitGroupExpr(Group &) override;
+  void visitBoolLiteralExpr(BoolLiteral &) override {}
+  void visitStrLiteralExpr(StrLiteral &) override;
+  void visitNullLiteralExpr(NullLiteral &) override {}
+  void visitNumLiteralExpr(NumLiteral &) override {}
+  void visitLogicalExpr(Logical &) override;
+  void visitVariableExpr(Variable &) override;
+  void visitUnaryExpr(Unary &) override;
+
+  void visitBlockStmt(Block &) override;
+  void visitExpressionStmt(Expression &) override;
+  void visitFnStmt(Fn &) override;
+  void visitIfStmt(If &) override;
+  void visitWhileStmt(While &) override;
+  void visitVarStmt(Var &) override;
+  void visitReturnStmt(Return &) override;
+  void visitBreakStmt(Break &) override {}
+  void visitContinueStmt(Continue &) override {}
+
+ public:
+  Resolver(Globals &globals, bool tail_calls)
+      : globals_(globals)
+      , tail_calls_(tail_calls) {}
+
+  // A program's top level, whose declarations are globals
+  void resolve_program(StatementsList);
+  // A function's body. Bodies the parser skipped over are left for when they
+  // have been parsed.
+  void resolve_function(Fn &);
+};
+
+} // namespace lox
+
+#endif // LOX_RESOLVER_HPP
@@ -7,7 +7,7 @@
 namespace lox {
 
 void Scanner::add_token(TokenType type) {
-  tokens_.emplace_back(type, slice_token(), line_, current_);
+  pending_.emplace(type, slice_token(), line_, current_);
 }
 
 char Scanner::advance() { return source_.at(current_++); }
@@ -15,10 +15,7 @@ char Scanner::advance() { return source_.at(current_++); }
 void Scanner::consume_identifier() {
   while (absl::ascii_isalnum(peek()) || peek() == '_') { advance(); }
 
-  auto ident = slice_token();
-  auto type  = TokenType::IDENT;
-  if (keywords_.find(ident) != keywords_.end()) { type = keywords_.at(ident); }
-  add_token(type);
+  add_token(keyword_type(slice_token()));
 }
 
 void Scanner::consume_number() {
@@ -38,7 +35,9 @@ void Scanner::consume_string() {
   }
 
   if (at_end()) {
-    report_error("Unterminated string", Location{}.line(line_));
+    if (!quiet_) {
+      report_error("Unterminated string", Location{}.line(line_));
+    }
     return;
   }
 
@@ -99,7 +98,7 @@ void Scanner::scan_token() {
       consume_number();
     } else if (absl::ascii_isalpha(chr)) {
       consume_identifier();
-    } else {
+    } else if (!quiet_) {
       report_error("Unexpected character",
                    Location{}.line(line_).chr(current_));
     }
@@ -112,13 +111,40 @@ absl::string_view Scanner::slice_token() const {
   return {b + start_, b + current_};
 }
 
-std::vector<Token> &Scanner::tokenise() {
-  while (!at_end()) {
+// Each call to scan_token() adds at most one token, so pending_ never has to
+// hold more than that
+Token Scanner::next_token() {
+  while (!pending_ && !at_end()) {
     start_ = current_;
     scan_token();
   }
-  tokens_.emplace_back(TokenType::EOF, "", line_, current_ + 1);
-  return tokens_;
+  if (!pending_) { return Token(TokenType::EOF, "", line_, current_ + 1); }
+  Token tok = *pending_;
+  pending_.reset();
+  return tok;
+}
+
+std::vector<Token> Scanner::tokenise() {
+  std::vector<Token> tokens;
+  do {
+    tokens.push_back(next_token());
+  } while (tokens.back().type() != TokenType::EOF);
+  return tokens;
+}
+
+TokenBuffer Scanner::tokenise_compact() {
+  TokenBuffer tokens(source_);
+  // A rough guess from typical scripts, saves most of the regrowth
+  tokens.reserve((source_.length() - current_) / 8);
+  while (true) {
+    auto tok = next_token();
+    if (tok.type() == TokenType::EOF) {
+      tokens.push_back(TokenType::EOF, source_.length(), 0);
+      return tokens;
+    }
+    auto length = tok.lexeme().length();
+    tokens.push_back(tok.type(), tok.offset() - length, length);
+  }
 }
 
 } // namespace lox
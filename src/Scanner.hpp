@@ -3,21 +3,23 @@
 
 #include "KeywordNames.hpp"
 #include "Token.hpp"
+#include "TokenBuffer.hpp"
+#include "TokenSource.hpp"
 
 #include <absl/strings/string_view.h>
 
-#include <unordered_map>
+#include <optional>
 #include <vector>
 
 namespace lox {
 
-class Scanner {
+class Scanner : public TokenSource {
   const absl::string_view source_;
-  std::vector<Token> tokens_;
-  const std::unordered_map<absl::string_view, TokenType> &keywords_;
+  std::optional<Token> pending_;
   size_t start_   = 0;
   size_t current_ = 0;
   int line_       = 1;
+  bool quiet_     = false;
 
   char advance();
   void add_token(TokenType);
@@ -35,10 +37,27 @@ class Scanner {
  public:
   Scanner(absl::string_view src)
       : source_(src)
-      , tokens_{}
-      , keywords_(get_keywords()) {}
+      , pending_{} {}
 
-  std::vector<Token> &tokenise();
+  // Start scanning part way into the source, e.g. at a chunk or function
+  // body boundary. Offsets stay relative to the start of the source.
+  Scanner &start_at(size_t offset, int line) {
+    current_ = offset;
+    line_    = line;
+    return *this;
+  }
+  // Don't report lexical errors, for text that has been scanned before
+  Scanner &quietly() {
+    quiet_ = true;
+    return *this;
+  }
+
+  // Scans just far enough to produce the next token
+  Token next_token() override;
+  // Scans the whole source up front, EOF token included
+  std::vector<Token> tokenise();
+  // As above, but into the packed representation
+  TokenBuffer tokenise_compact();
 };
 
 } // namespace lox
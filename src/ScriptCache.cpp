@@ -0,0 +1,156 @@
+#include "ScriptCache.hpp"
+#include "Source.hpp"
+
+#include <fmt/format.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Set by the build from the VERSION file
+#ifndef LOX_VERSION
+#define LOX_VERSION "unknown"
+#endif
+
+namespace lox {
+
+namespace {
+
+std::error_code last_error() { return {errno, std::generic_category()}; }
+
+// A fast, stable 64-bit hash: eight bytes at a time, each mixed in with a
+// multiply and a shift. It only has to tell scripts apart, not resist anyone.
+uint64_t hash(absl::string_view bytes, uint64_t seed) {
+  constexpr uint64_t k = 0x9E3779B97F4A7C15ull;
+  uint64_t h           = seed ^ (bytes.size() * k);
+  auto mix             = [&h](uint64_t word) {
+    h = (h ^ word) * k;
+    h ^= h >> 29;
+  };
+  size_t i = 0;
+  for (; i + 8 <= bytes.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes.data() + i, 8);
+    mix(word);
+  }
+  if (i < bytes.size()) {
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+    mix(tail);
+  }
+  return h ^ (h >> 32);
+}
+
+struct Header {
+  char magic[4];
+  uint32_t variant;
+  uint32_t semantics;
+  uint32_t spare;
+  char version[16];
+  uint64_t source_hash;
+  uint64_t source_size;
+  uint64_t payload_size;
+  uint64_t payload_hash;
+};
+static_assert(sizeof(Header) % 8 == 0);
+
+constexpr char magic[4] = {'L', 'O', 'X', 'C'};
+
+Header make_header(absl::string_view source, uint32_t variant) {
+  Header header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.variant   = variant;
+  header.semantics = FlatAst::semantics_version;
+  std::strncpy(header.version, LOX_VERSION, sizeof(header.version) - 1);
+  header.source_hash = hash(source, 0);
+  header.source_size = source.size();
+  return header;
+}
+
+} // namespace
+
+std::optional<ScriptCache> ScriptCache::open_default() {
+  if (auto dir = std::getenv("LOX_CACHE_DIR"); dir && *dir) {
+    return ScriptCache(dir);
+  }
+  if (auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+    return ScriptCache(fmt::format("{}/cxx-lox", xdg));
+  }
+  if (auto home = std::getenv("HOME"); home && *home) {
+    return ScriptCache(fmt::format("{}/.cache/cxx-lox", home));
+  }
+  return std::nullopt;
+}
+
+std::string ScriptCache::path(absl::string_view source,
+                              uint32_t variant) const {
+  auto seed = (uint64_t{FlatAst::semantics_version} << 32) | variant;
+  auto key  = hash(source, hash(LOX_VERSION, seed));
+  return fmt::format("{}/{:016x}.loxc", dir_, key);
+}
+
+std::optional<FlatAst> ScriptCache::load(absl::string_view source,
+                                         uint32_t variant) const {
+  Source file;
+  if (file.load(path(source, variant))) { return std::nullopt; }
+
+  auto bytes    = file.text();
+  auto expected = make_header(source, variant);
+  Header header;
+  if (bytes.size() < sizeof(header)) { return std::nullopt; }
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  auto payload          = bytes.substr(sizeof(header));
+  expected.payload_size = payload.size();
+  expected.payload_hash = hash(payload, 0);
+  if (std::memcmp(&header, &expected, sizeof(header)) != 0) {
+    return std::nullopt;
+  }
+  return FlatAst::deserialise(std::move(file), sizeof(header));
+}
+
+std::error_code ScriptCache::store(absl::string_view source, uint32_t variant,
+                                   const FlatAst &ast) const {
+  std::error_code err;
+  std::filesystem::create_directories(dir_, err);
+  if (err) { return err; }
+
+  auto payload        = ast.serialise();
+  auto header         = make_header(source, variant);
+  header.payload_size = payload.size();
+  header.payload_hash = hash(payload, 0);
+
+  auto target = path(source, variant);
+  auto temp   = fmt::format("{}.{}.tmp", target, ::getpid());
+  auto fd     = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       0644);
+  if (fd < 0) { return last_error(); }
+
+  auto write_all = [fd](const char *data, size_t size) {
+    while (size > 0) {
+      auto n = ::write(fd, data, size);
+      if (n < 0) {
+        if (errno == EINTR) { continue; }
+        return false;
+      }
+      data += n;
+      size -= static_cast<size_t>(n);
+    }
+    return true;
+  };
+  auto ok = write_all(reinterpret_cast<const char *>(&header),
+                      sizeof(header)) &&
+            write_all(payload.data(), payload.size());
+  if (!ok) { err = last_error(); }
+  ::close(fd);
+  if (ok && ::rename(temp.c_str(), target.c_str()) != 0) {
+    err = last_error();
+  }
+  if (err) { ::unlink(temp.c_str()); }
+  return err;
+}
+
+} // namespace lox
@@ -0,0 +1,47 @@
+#ifndef LOX_SCRIPTCACHE_HPP
+#define LOX_SCRIPTCACHE_HPP
+
+#include "FlatAst.hpp"
+
+#include <absl/strings/string_view.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <system_error>
+
+namespace lox {
+
+// Compiled scripts kept on disk between runs, so that running an unchanged
+// script again skips the scanner and parser altogether. Entries are .loxc
+// files named after a hash of the source text, the interpreter version,
+// FlatAst::semantics_version and whatever options shaped the tree
+// (`variant`). Each is a small header followed by a serialised FlatAst; all
+// sections are 8-byte aligned, and a loaded tree reads them in place from the
+// mapped file. A load re-checks everything in the header, including a hash of
+// the payload, and the FlatAst validates every index, so stale, truncated or
+// otherwise damaged entries are simply treated as misses.
+class ScriptCache {
+  std::string dir_;
+
+  std::string path(absl::string_view source, uint32_t variant) const;
+
+ public:
+  explicit ScriptCache(std::string dir)
+      : dir_(std::move(dir)) {}
+
+  // $LOX_CACHE_DIR, else $XDG_CACHE_HOME/cxx-lox, else ~/.cache/cxx-lox
+  static std::optional<ScriptCache> open_default();
+
+  std::optional<FlatAst> load(absl::string_view source, uint32_t variant) const;
+  // Writes to a temporary file first and renames it into place, so
+  // concurrent runs of the same script never see half an entry
+  std::error_code store(absl::string_view source, uint32_t variant,
+                        const FlatAst &) const;
+
+  const std::string &dir() const { return dir_; }
+};
+
+} // namespace lox
+
+#endif // LOX_SCRIPTCACHE_HPP
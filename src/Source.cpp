@@ -0,0 +1,86 @@
+#include "Source.hpp"
+
+#include <cerrno>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lox {
+
+namespace {
+
+std::error_code last_error() { return {errno, std::generic_category()}; }
+
+// Closes the descriptor on every way out of load()
+struct Fd {
+  int fd;
+  ~Fd() {
+    if (fd >= 0) { ::close(fd); }
+  }
+};
+
+} // namespace
+
+Source::Source(Source &&other) { *this = std::move(other); }
+
+Source &Source::operator=(Source &&other) {
+  if (this == &other) { return *this; }
+  release();
+  mapping_ = std::exchange(other.mapping_, nullptr);
+  size_    = std::exchange(other.size_, 0);
+  owned_   = std::move(other.owned_);
+  data_    = mapping_ ? static_cast<const char *>(mapping_) : owned_.data();
+  other.data_ = nullptr;
+  return *this;
+}
+
+void Source::release() {
+  if (mapping_) { ::munmap(mapping_, size_); }
+  mapping_ = nullptr;
+  data_    = nullptr;
+  size_    = 0;
+  owned_.clear();
+}
+
+std::error_code Source::load(absl::string_view path) {
+  release();
+  Fd file{::open(std::string(path).c_str(), O_RDONLY | O_CLOEXEC)};
+  if (file.fd < 0) { return last_error(); }
+
+  struct stat st;
+  if (::fstat(file.fd, &st) != 0) { return last_error(); }
+
+  // mmap refuses zero-length mappings, and an empty script has nothing worth
+  // mapping anyway
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    auto len = static_cast<size_t>(st.st_size);
+    auto map = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, file.fd, 0);
+    if (map != MAP_FAILED) {
+      ::madvise(map, len, MADV_SEQUENTIAL);
+      mapping_ = map;
+      data_    = static_cast<const char *>(map);
+      size_    = len;
+      return {};
+    }
+  }
+
+  // Pipes, /dev/stdin and friends: read until EOF
+  char buf[64 * 1024];
+  while (true) {
+    auto n = ::read(file.fd, buf, sizeof(buf));
+    if (n == 0) { break; }
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      return last_error();
+    }
+    owned_.append(buf, static_cast<size_t>(n));
+  }
+  data_ = owned_.data();
+  size_ = owned_.size();
+  return {};
+}
+
+} // namespace lox
@@ -0,0 +1,45 @@
+#ifndef LOX_SOURCE_HPP
+#define LOX_SOURCE_HPP
+
+#include <absl/strings/string_view.h>
+
+#include <cstddef>
+#include <string>
+#include <system_error>
+
+namespace lox {
+
+// The text of a script. Regular files are mapped read-only straight from the
+// page cache; pipes, terminals and anything else that can't be mapped are read
+// into an owned string instead. Tokens and AST nodes hold views into text(),
+// so a Source must outlive everything parsed from it.
+class Source {
+  const char *data_ = nullptr;
+  size_t size_      = 0;
+  void *mapping_    = nullptr;
+  std::string owned_;
+
+  void release();
+
+ public:
+  Source() = default;
+  explicit Source(std::string &&text)
+      : owned_(std::move(text)) {
+    data_ = owned_.data();
+    size_ = owned_.size();
+  }
+  Source(Source &&);
+  Source &operator=(Source &&);
+  Source(const Source &)            = delete;
+  Source &operator=(const Source &) = delete;
+  ~Source() { release(); }
+
+  std::error_code load(absl::string_view path);
+
+  absl::string_view text() const { return {data_, size_}; }
+  bool mapped() const { return mapping_ != nullptr; }
+};
+
+} // namespace lox
+
+#endif // LOX_SOURCE_HPP
@@ -4,15 +4,18 @@
 #include "Expr.hpp"
 #include "Token.hpp"
 
-#include <absl/container/inlined_vector.h>
+#include <absl/types/span.h>
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
-#include <variant>
+#include <type_traits>
 
 namespace lox {
 
+enum class Completion : uint8_t { Normal, Break, Continue, Return };
+
 namespace stmt {
 
 template <typename T>
@@ -23,7 +26,12 @@ struct Visitor;
 struct Stmt {
   virtual void accept(stmt::Visitor<void> &)               = 0;
   virtual std::string accept(stmt::Visitor<std::string> &) = 0;
-  virtual ~Stmt()                                          = default;
+  virtual Completion accept(stmt::Visitor<Completion> &)   = 0;
+
+  // Nodes live in an Arena and are never deleted through a base pointer,
+  // which keeps every one of them trivially destructible
+ protected:
+  ~Stmt() = default;
 };
 
 struct Block;
@@ -32,6 +40,9 @@ struct Fn;
 struct If;
 struct While;
 struct Var;
+struct Return;
+struct Break;
+struct Continue;
 
 namespace stmt {
 
@@ -43,26 +54,37 @@ struct Visitor {
   virtual T visitIfStmt(If &)                 = 0;
   virtual T visitWhileStmt(While &)           = 0;
   virtual T visitVarStmt(Var &)               = 0;
+  virtual T visitReturnStmt(Return &)         = 0;
+  virtual T visitBreakStmt(Break &)           = 0;
+  virtual T visitContinueStmt(Continue &)     = 0;
   virtual ~Visitor()                          = default;
 };
 
 } // namespace stmt
 
-using StmtPtr        = std::shared_ptr<Stmt>;
-using StatementsList = absl::InlinedVector<std::shared_ptr<lox::Stmt>, 8>;
+// Owned by the Arena the parser allocated them in
+using StmtPtr        = Stmt *;
+using StatementsList = absl::Span<const StmtPtr>;
+
+using TokensList = absl::Span<const Token>;
 
-using TokensList = absl::InlinedVector<Token, 8>;
+// Where to find a function body that hasn't been parsed yet, see Parser.hpp
+struct LazyBody;
 
 struct Block : Stmt {
   StatementsList statements_;
-  Block(StatementsList &&statements)
-      : statements_(std::move(statements)) {}
+  uint32_t slots_ = 0;
+  Block(StatementsList statements)
+      : statements_(statements) {}
   void accept(stmt::Visitor<void> &v) override {
     return v.visitBlockStmt(*this);
   }
   std::string accept(stmt::Visitor<std::string> &v) override {
     return v.visitBlockStmt(*this);
   }
+  Completion accept(stmt::Visitor<Completion> &v) override {
+    return v.visitBlockStmt(*this);
+  }
 };
 
 struct Expression : Stmt {
@@ -75,20 +97,30 @@ struct Expression : Stmt {
   std::string accept(stmt::Visitor<std::string> &v) override {
     return v.visitExpressionStmt(*this);
   }
+  Completion accept(stmt::Visitor<Completion> &v) override {
+    return v.visitExpressionStmt(*this);
+  }
 };
 
 struct Fn : Stmt {
   Token name_;
   TokensList tokens_;
   StatementsList statements_;
-  Fn(Token name, TokensList tokens, StatementsList statements)
+  LazyBody *lazy_;
+  Binding binding_ = {};
+  uint32_t slots_  = 0;
+  Fn(Token name, TokensList tokens, StatementsList statements, LazyBody *lazy)
       : name_(name)
       , tokens_(tokens)
-      , statements_(statements) {}
+      , statements_(statements)
+      , lazy_(lazy) {}
   void accept(stmt::Visitor<void> &v) override { return v.visitFnStmt(*this); }
   std::string accept(stmt::Visitor<std::string> &v) override {
     return v.visitFnStmt(*this);
   }
+  Completion accept(stmt::Visitor<Completion> &v) override {
+    return v.visitFnStmt(*this);
+  }
 };
 
 struct If : Stmt {
@@ -103,25 +135,34 @@ struct If : Stmt {
   std::string accept(stmt::Visitor<std::string> &v) override {
     return v.visitIfStmt(*this);
   }
+  Completion accept(stmt::Visitor<Completion> &v) override {
+    return v.visitIfStmt(*this);
+  }
 };
 
 struct While : Stmt {
   ExprPtr condition_;
   StmtPtr body_;
-  While(ExprPtr condition, StmtPtr body)
+  ExprPtr increment_;
+  While(ExprPtr condition, StmtPtr body, ExprPtr increment)
       : condition_(condition)
-      , body_(body) {}
+      , body_(body)
+      , increment_(increment) {}
   void accept(stmt::Visitor<void> &v) override {
     return v.visitWhileStmt(*this);
   }
   std::string accept(stmt::Visitor<std::string> &v) override {
     return v.visitWhileStmt(*this);
   }
+  Completion accept(stmt::Visitor<Completion> &v) override {
+    return v.visitWhileStmt(*this);
+  }
 };
 
 struct Var : Stmt {
   Token name_;
   ExprPtr initialiser_;
+  Binding binding_ = {};
   Var(Token name, ExprPtr initialiser)
       : name_(name)
       , initialiser_(initialiser) {}
@@ -129,7 +170,61 @@ struct Var : Stmt {
   std::string accept(stmt::Visitor<std::string> &v) override {
     return v.visitVarStmt(*this);
   }
+  Completion accept(stmt::Visitor<Completion> &v) override {
+    return v.visitVarStmt(*this);
+  }
 };
 
+struct Return : Stmt {
+  ExprPtr value_;
+  Return(ExprPtr value)
+      : value_(value) {}
+  void accept(stmt::Visitor<void> &v) override {
+    return v.visitReturnStmt(*this);
+  }
+  std::string accept(stmt::Visitor<std::string> &v) override {
+    return v.visitReturnStmt(*this);
+  }
+  Completion accept(stmt::Visitor<Completion> &v) override {
+    return v.visitReturnStmt(*this);
+  }
+};
+
+struct Break : Stmt {
+  Break() {}
+  void accept(stmt::Visitor<void> &v) override {
+    return v.visitBreakStmt(*this);
+  }
+  std::string accept(stmt::Visitor<std::string> &v) override {
+    return v.visitBreakStmt(*this);
+  }
+  Completion accept(stmt::Visitor<Completion> &v) override {
+    return v.visitBreakStmt(*this);
+  }
+};
+
+struct Continue : Stmt {
+  Continue() {}
+  void accept(stmt::Visitor<void> &v) override {
+    return v.visitContinueStmt(*this);
+  }
+  std::string accept(stmt::Visitor<std::string> &v) override {
+    return v.visitContinueStmt(*this);
+  }
+  Completion accept(stmt::Visitor<Completion> &v) override {
+    return v.visitContinueStmt(*this);
+  }
+};
+
+static_assert(std::is_trivially_destructible_v<Block>);
+static_assert(std::is_trivially_destructible_v<Expression>);
+static_assert(std::is_trivially_destructible_v<Fn>);
+static_assert(std::is_trivially_destructible_v<If>);
+static_assert(std::is_trivially_destructible_v<While>);
+static_assert(std::is_trivially_destructible_v<Var>);
+static_assert(std::is_trivially_destructible_v<Return>);
+static_assert(std::is_trivially_destructible_v<Break>);
+static_assert(std::is_trivially_destructible_v<Continue>);
+
 } // namespace lox
 #endif // LOX_STMT_HPP
@@ -10,41 +10,44 @@
 
 namespace lox {
 
+// Tokens are small value types: the lexeme is a view into the source and
+// literal values are only decoded when the parser asks for them.
 class Token {
-  TokenType type_;
+  TokenType type_ = TokenType::EOF;
+  int line_       = 0;
   absl::string_view lexeme_;
-  absl::string_view identifier_;
-  absl::string_view string_;
-  double number_ = 0.;
-  int line_;
-  size_t offset_;
+  size_t offset_ = 0;
 
  public:
+  Token() = default;
   Token(TokenType type, absl::string_view lexeme, int line, size_t offset)
       : type_(type)
-      , lexeme_(lexeme)
       , line_(line)
-      , offset_(offset) {
-    switch (type_) {
-    case TokenType::IDENT: identifier_ = lexeme_; break;
-    case TokenType::STRING:
-      string_ =
-          lexeme_ == "\"\"" ? "" : lexeme_.substr(1, lexeme_.length() - 2);
-      break;
-    case TokenType::NUMBER:
-      if (!absl::SimpleAtod(lexeme_, &number_)) {
-        report_error("Number out of range?", Location{}.line(line_));
-      };
-      break;
-    default: break; // Do nothing
-    }
-  }
+      , lexeme_(lexeme)
+      , offset_(offset) {}
 
   auto type() const { return type_; }
   auto lexeme() const { return lexeme_; }
-  auto identifier() const { return identifier_; }
-  auto string() const { return string_; }
-  auto number() const { return number_; }
+  auto line() const { return line_; }
+  // One past the end of the lexeme
+  auto offset() const { return offset_; }
+
+  absl::string_view identifier() const {
+    return type_ == TokenType::IDENT ? lexeme_ : absl::string_view{};
+  }
+
+  absl::string_view string() const {
+    if (type_ != TokenType::STRING) { return {}; }
+    return lexeme_ == "\"\"" ? "" : lexeme_.substr(1, lexeme_.length() - 2);
+  }
+
+  double number() const {
+    double number = 0.;
+    if (type_ == TokenType::NUMBER && !absl::SimpleAtod(lexeme_, &number)) {
+      report_error("Number out of range?", Location{}.line(line_));
+    }
+    return number;
+  }
 
   auto location() const {
     return Location{}.line(line_).chr(offset_).end_chr(offset_ +
@@ -54,9 +57,9 @@ class Token {
   operator std::string() const {
     auto value = [&]() -> std::string {
       switch (type_) {
-        case TokenType::IDENT: return std::string(identifier_);
-        case TokenType::STRING: return std::string(string_);
-      case TokenType::NUMBER: return std::to_string(number_);
+      case TokenType::IDENT: return std::string(identifier());
+      case TokenType::STRING: return std::string(string());
+      case TokenType::NUMBER: return std::to_string(number());
       default: return "";
       }
     }();
@@ -0,0 +1,85 @@
+#include "TokenBuffer.hpp"
+
+#include <absl/base/macros.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace lox {
+
+static_assert(token_type_count <= std::numeric_limits<uint8_t>::max(),
+              "TokenType no longer fits in the packed type array");
+
+void TokenBuffer::push_back(TokenType type, size_t offset, size_t length) {
+  ABSL_ASSERT(offset + length <= std::numeric_limits<uint32_t>::max());
+  types_.push_back(static_cast<uint8_t>(type));
+  spans_.push_back({static_cast<uint32_t>(offset),
+                    static_cast<uint32_t>(length)});
+}
+
+void TokenBuffer::reserve(size_t count) {
+  types_.reserve(count);
+  spans_.reserve(count);
+}
+
+void TokenBuffer::splice(const TokenBuffer &other) {
+  ABSL_ASSERT(other.source_.data() == source_.data());
+  auto count = other.size();
+  if (count && other.type(count - 1) == TokenType::EOF) { count--; }
+  types_.insert(types_.end(), other.types_.begin(),
+                other.types_.begin() + count);
+  spans_.insert(spans_.end(), other.spans_.begin(),
+                other.spans_.begin() + count);
+}
+
+size_t TokenBuffer::memory_usage() const {
+  return types_.capacity() * sizeof(uint8_t) +
+         spans_.capacity() * sizeof(Span) +
+         newlines_.capacity() * sizeof(uint32_t);
+}
+
+void TokenBuffer::index_lines() const {
+  auto b = source_.data();
+  auto e = b + source_.length();
+  for (auto p = b; (p = static_cast<const char *>(
+                        std::memchr(p, '\n', e - p))) != nullptr;
+       ++p) {
+    newlines_.push_back(static_cast<uint32_t>(p - b));
+  }
+  indexed_ = true;
+}
+
+// The scanner stamps a token with the line it was on when the token ended, so
+// a string running over several lines reports its last one. Count the
+// newlines before the end of the lexeme to match.
+int TokenBuffer::line(size_t i) const {
+  if (!indexed_) { index_lines(); }
+  auto end = spans_[i].offset + spans_[i].length;
+  return 1 + static_cast<int>(
+                 std::lower_bound(newlines_.begin(), newlines_.end(), end) -
+                 newlines_.begin());
+}
+
+int TokenBuffer::line(size_t i, size_t &cursor) const {
+  if (!indexed_) { index_lines(); }
+  auto end = spans_[i].offset + spans_[i].length;
+  while (cursor < newlines_.size() && newlines_[cursor] < end) { cursor++; }
+  return 1 + static_cast<int>(cursor);
+}
+
+// Token offsets point one past the lexeme, and the EOF token sits one past
+// the end of the source
+Token TokenBuffer::token(size_t i, int line) const {
+  auto type = this->type(i);
+  auto end  = spans_[i].offset + spans_[i].length;
+  return Token(type, lexeme(i), line, type == TokenType::EOF ? end + 1 : end);
+}
+
+Token TokenReader::next_token() {
+  // Keep handing out the trailing EOF once we get there
+  auto i = next_ + 1 < buffer_.size() ? next_++ : buffer_.size() - 1;
+  return buffer_.token(i, buffer_.line(i, line_cursor_));
+}
+
+} // namespace lox
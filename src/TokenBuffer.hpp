@@ -0,0 +1,78 @@
+#ifndef LOX_TOKENBUFFER_HPP
+#define LOX_TOKENBUFFER_HPP
+
+#include "Token.hpp"
+#include "TokenSource.hpp"
+#include "TokenTypes.hpp"
+
+#include <absl/strings/string_view.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace lox {
+
+// Structure-of-arrays token storage for when the whole stream has to be kept
+// around: one byte of type and a 32-bit offset/length pair into the source
+// per token, roughly nine bytes against the 32 of a Token. Lines are not
+// stored at all; they are worked out from a newline index of the source,
+// which is only built the first time somebody asks for one.
+class TokenBuffer {
+  struct Span {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  absl::string_view source_;
+  std::vector<uint8_t> types_;
+  std::vector<Span> spans_;
+  mutable std::vector<uint32_t> newlines_;
+  mutable bool indexed_ = false;
+
+  void index_lines() const;
+
+ public:
+  explicit TokenBuffer(absl::string_view source)
+      : source_(source) {}
+
+  void push_back(TokenType, size_t offset, size_t length);
+  void reserve(size_t count);
+  // Appends every token of another buffer over the same source, except for
+  // its trailing EOF
+  void splice(const TokenBuffer &);
+
+  size_t size() const { return types_.size(); }
+  absl::string_view source() const { return source_; }
+  size_t memory_usage() const;
+
+  TokenType type(size_t i) const { return static_cast<TokenType>(types_[i]); }
+  absl::string_view lexeme(size_t i) const {
+    return source_.substr(spans_[i].offset, spans_[i].length);
+  }
+  // Not thread-safe the first time round, since it builds the line index
+  int line(size_t i) const;
+  // For front-to-back walks: `cursor` remembers how far through the line
+  // index the previous call got, making each lookup amortised O(1)
+  int line(size_t i, size_t &cursor) const;
+
+  Token token(size_t i, int line) const;
+  Token operator[](size_t i) const { return token(i, line(i)); }
+};
+
+// Feeds a TokenBuffer to the parser front to back
+class TokenReader : public TokenSource {
+  const TokenBuffer &buffer_;
+  size_t next_        = 0;
+  size_t line_cursor_ = 0;
+
+ public:
+  explicit TokenReader(const TokenBuffer &buffer)
+      : buffer_(buffer) {}
+
+  Token next_token() override;
+};
+
+} // namespace lox
+
+#endif // LOX_TOKENBUFFER_HPP
@@ -0,0 +1,18 @@
+#ifndef LOX_TOKENSOURCE_HPP
+#define LOX_TOKENSOURCE_HPP
+
+#include "Token.hpp"
+
+namespace lox {
+
+// Anything the parser can pull tokens from, one at a time. Once the input is
+// exhausted every further call must keep returning an EOF token.
+class TokenSource {
+ public:
+  virtual ~TokenSource() {};
+  virtual Token next_token() = 0;
+};
+
+} // namespace lox
+
+#endif // LOX_TOKENSOURCE_HPP
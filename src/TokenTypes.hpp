@@ -14,6 +14,11 @@ enum class TokenType : int {
 #include "TokenTypes.inc"
 };
 
+#define X(name, _) +1
+inline constexpr int token_type_count = 0
+#include "TokenTypes.inc"
+    ;
+
 const std::string &to_string(TokenType);
 
 } // namespace lox
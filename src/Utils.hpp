@@ -3,6 +3,7 @@
 
 #include "Callable.hpp"
 #include "Expr.hpp"
+#include "Value.hpp"
 
 #include <absl/base/macros.h>
 
@@ -45,22 +46,12 @@ auto make_reverse(T &iter) {
 
 namespace lox {
 
-class Callable;
-using CallablePtr = std::shared_ptr<Callable>;
-
-// Utils now needs to know this but not all the rest of Expr
-using ExprResult =
-    std::variant<bool, double, std::string, std::nullptr_t, CallablePtr>;
-
-inline std::string to_string(ExprResult res) {
-  auto visitor = util::Overloaded{
-      [](bool a) -> std::string { return a ? "true" : "false"; },
-      [](double a) { return std::to_string(a); },
-      [](std::string a) { return a; },
-      [](std::nullptr_t) -> std::string { return "nil"; },
-      [](CallablePtr c) -> std::string { return c->to_string(); }
-      };
-  return std::visit(visitor, res);
+inline std::string to_string(const Value &value) {
+  if (value.is_number()) { return std::to_string(value.as_number()); }
+  if (value.is_bool()) { return value.as_bool() ? "true" : "false"; }
+  if (value.is_string()) { return std::string(value.as_string().text()); }
+  if (value.is_callable()) { return value.as_callable()->to_string(); }
+  return "nil";
 }
 
 } // namespace lox
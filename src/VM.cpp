@@ -0,0 +1,447 @@
+#include "Builtins.hpp"
+#include "Compiler.hpp"
+#include "Error.hpp"
+#include "Interpreter.hpp"
+#include "Parser.hpp"
+#include "Profiler.hpp"
+#include "Resolver.hpp"
+#include "Utils.hpp"
+#include "VM.hpp"
+
+#include <absl/strings/str_cat.h>
+#include <absl/types/span.h>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+// Jumping straight from one instruction's code to the next one's through a
+// table of label addresses, rather than back round a loop to a switch, gives
+// every instruction its own indirect branch to predict
+#if defined(__GNUC__) || defined(__clang__)
+#define LOX_COMPUTED_GOTO 1
+#else
+#define LOX_COMPUTED_GOTO 0
+#endif
+
+namespace lox {
+
+namespace {
+
+constexpr size_t initial_stack = 16 * 1024;
+// Far deeper than the tree-walker could recurse before running out of stack
+constexpr size_t max_frames = 64 * 1024;
+
+// What a call with `argc` arguments on top of the stack calls, once it is
+// known to be something that takes that many
+Callable &callee(Value *sp, uint32_t argc) {
+  auto &fn = sp[-1 - static_cast<int>(argc)];
+  if (!fn.is_callable()) {
+    throw RuntimeError("Attempted to call expression that was not a function");
+  }
+  auto &callee = *fn.as_callable();
+  if (static_cast<int>(argc) != callee.arity()) {
+    throw RuntimeError(fmt::format("Expected {} arguments to function, got {}.",
+                                   callee.arity(), argc));
+  }
+  return callee;
+}
+
+// Replaces the callee and arguments with what the call gave, and gives the
+// new top of the stack
+Value *call_native(Callable &callee, Value *sp, uint32_t argc) {
+  auto native = dynamic_cast<Native *>(&callee);
+  ABSL_ASSERT(native);
+  Args args(std::make_move_iterator(sp - argc), std::make_move_iterator(sp));
+  auto result = native->call(std::move(args));
+  sp -= argc;
+  sp[-1] = std::move(result);
+  return sp;
+}
+
+} // namespace
+
+Value CompiledFunction::operator()(Interpreter &, Args &&) {
+  throw RuntimeError("Compiled functions can only be called by the VM");
+}
+
+// Without the JIT built in, asking for it does nothing
+VM::VM(bool tail_calls, [[maybe_unused]] bool jit)
+    : tail_calls_(tail_calls) {
+  globals_.define("now", Value(new Now{}));
+  globals_.define("print", Value(new Print{}));
+  stack_.resize(initial_stack);
+  heap().add_roots(this);
+#if LOX_JIT
+  if (jit) { jit_ = std::make_unique<Jit>(*this); }
+#endif
+}
+
+VM::~VM() { heap().remove_roots(this); }
+
+void VM::trace_roots(Heap &heap) {
+  globals_.trace(heap);
+  heap.mark(absl::MakeConstSpan(stack_.data(), top_));
+}
+
+void VM::interpret(StatementsList list) {
+  Resolver(globals_, tail_calls_).resolve_program(list);
+  auto script = Compiler(protos_).compile_program(list);
+  // The bottom slot stands in for the function being called
+  reserve(1 + script.frame_size + script.max_stack);
+  frames_.push_back(Frame{&script, script.code.data(), 1});
+  top_ = 1 + script.frame_size;
+  // Whatever was left there may have been collected since
+  std::fill(stack_.begin(), stack_.begin() + top_, Value());
+  try {
+    run();
+  } catch (RuntimeError const &e) { report_error(e.what(), Location{}); }
+  frames_.clear();
+  handlers_.clear();
+}
+
+void VM::run() {
+  for (;;) {
+    try {
+      execute();
+      return;
+    } catch (...) {
+      if (!unwind()) { throw; }
+    }
+  }
+}
+
+bool VM::unwind() {
+  auto frame = frames_.size() - 1;
+  if (!handlers_.empty() && handlers_.back().frame == frame) {
+    auto handler = handlers_.back();
+    handlers_.pop_back();
+    top_              = handler.stack;
+    frames_.back().ip = frames_.back().chunk->code.data() + handler.target;
+    return true;
+  }
+  if (frame == 0) { return false; }
+  // The call ends there, and returns nil like any other
+  top_ = frames_.back().base - 1;
+  frames_.pop_back();
+  if (auto profiler = Profiler::running()) { profiler->leave(); }
+  stack_[top_++] = nullptr;
+  return true;
+}
+
+void VM::reserve(size_t size) {
+  if (size > stack_.size()) {
+    stack_.resize(std::max(size, 2 * stack_.size()));
+  }
+}
+
+void VM::compile(Proto &proto) {
+  if (proto.decl.lazy_) {
+    Parser::parse_body(proto.decl);
+    Resolver(globals_, tail_calls_).resolve_function(proto.decl);
+  }
+  Compiler(protos_).compile_function(proto);
+}
+
+void VM::execute() {
+  auto *frame = &frames_.back();
+  const Chunk *chunk;
+  const uint8_t *ip;
+  Value *slots;
+  Value *sp = stack_.data() + top_;
+
+#define LOAD_FRAME()                                                           \
+  do {                                                                         \
+    chunk = frame->chunk;                                                      \
+    ip    = frame->ip;                                                         \
+    slots = stack_.data() + frame->base;                                       \
+  } while (false)
+#define READ_OPERAND() (ip += sizeof(uint32_t), read_operand(ip - 4))
+#define JUMP_TO(target) (ip = chunk->code.data() + (target))
+#define SAFEPOINT()                                                            \
+  do {                                                                         \
+    top_ = static_cast<size_t>(sp - stack_.data());                            \
+    heap().safepoint();                                                        \
+  } while (false)
+// Coming into a chunk, the Jit may run it from here on instead
+#if LOX_JIT
+#define RUN_NATIVE()                                                           \
+  do {                                                                         \
+    if (jit_ && jit_->ready(*chunk)) {                                         \
+      auto offset = static_cast<size_t>(ip - chunk->code.data());              \
+      auto exit   = chunk->native->run(*this, slots, sp, offset);              \
+      sp          = exit.sp;                                                   \
+      ip          = chunk->code.data() + exit.offset;                          \
+    }                                                                          \
+  } while (false)
+#else
+#define RUN_NATIVE()                                                           \
+  do {                                                                         \
+  } while (false)
+#endif
+#define ARITHMETIC(op)                                                         \
+  do {                                                                         \
+    auto right = sp[-1].number();                                              \
+    sp[-2]     = sp[-2].number() op right;                                     \
+    sp--;                                                                      \
+  } while (false)
+
+  LOAD_FRAME();
+
+#if LOX_COMPUTED_GOTO
+#define X(name, _) &&op_##name,
+  static void *const targets[] = {
+#include "OpCodes.inc"
+  };
+#define TARGET(name) op_##name:
+#define DISPATCH() goto *targets[*ip++]
+  DISPATCH();
+#else
+#define TARGET(name) case Op::name:
+#define DISPATCH() continue
+  for (;;) {
+    switch (static_cast<Op>(*ip++)) {
+#endif
+
+  TARGET(CONSTANT) {
+    *sp++ = chunk->constants[READ_OPERAND()];
+    DISPATCH();
+  }
+  TARGET(NIL) {
+    *sp++ = nullptr;
+    DISPATCH();
+  }
+  TARGET(TRUE) {
+    *sp++ = true;
+    DISPATCH();
+  }
+  TARGET(FALSE) {
+    *sp++ = false;
+    DISPATCH();
+  }
+  TARGET(POP) {
+    sp--;
+    DISPATCH();
+  }
+  TARGET(GET_LOCAL) {
+    *sp++ = slots[READ_OPERAND()];
+    DISPATCH();
+  }
+  TARGET(SET_LOCAL) {
+    slots[READ_OPERAND()] = sp[-1];
+    DISPATCH();
+  }
+  TARGET(GET_GLOBAL) {
+    auto slot    = READ_OPERAND();
+    auto &global = globals_[slot];
+    if (!global) {
+      throw RuntimeError(
+          absl::StrCat("Undefined variable: ", globals_.name(slot)));
+    }
+    *sp++ = *global;
+    DISPATCH();
+  }
+  // Assigning to a global that was never defined does nothing
+  TARGET(SET_GLOBAL) {
+    if (auto &global = globals_[READ_OPERAND()]) { *global = sp[-1]; }
+    DISPATCH();
+  }
+  TARGET(DEFINE_GLOBAL) {
+    globals_.define(READ_OPERAND(), std::move(*--sp));
+    DISPATCH();
+  }
+  TARGET(ADD) {
+    auto &left = sp[-2], &right = sp[-1];
+    if (left.is_number() && right.is_number()) {
+      left = left.as_number() + right.as_number();
+      sp--;
+    } else if (left.is_string() && right.is_string()) {
+      left = String::concat(left.as_string(), right.as_string());
+      sp--;
+      SAFEPOINT();
+    } else {
+      throw RuntimeError("bad args to +");
+    }
+    DISPATCH();
+  }
+  TARGET(SUBTRACT) {
+    ARITHMETIC(-);
+    DISPATCH();
+  }
+  TARGET(MULTIPLY) {
+    ARITHMETIC(*);
+    DISPATCH();
+  }
+  TARGET(DIVIDE) {
+    ARITHMETIC(/);
+    DISPATCH();
+  }
+  TARGET(GREATER) {
+    ARITHMETIC(>);
+    DISPATCH();
+  }
+  TARGET(GREATER_EQUAL) {
+    ARITHMETIC(>=);
+    DISPATCH();
+  }
+  TARGET(LESS) {
+    ARITHMETIC(<);
+    DISPATCH();
+  }
+  TARGET(LESS_EQUAL) {
+    ARITHMETIC(<=);
+    DISPATCH();
+  }
+  TARGET(EQUAL) {
+    auto equal = isEqual(sp[-2], sp[-1]);
+    sp[-2]     = equal;
+    sp--;
+    DISPATCH();
+  }
+  TARGET(NOT_EQUAL) {
+    auto equal = isEqual(sp[-2], sp[-1]);
+    sp[-2]     = !equal;
+    sp--;
+    DISPATCH();
+  }
+  TARGET(NEGATE) {
+    sp[-1] = -sp[-1].number();
+    DISPATCH();
+  }
+  TARGET(NOT) {
+    sp[-1] = !isTruthy(sp[-1]);
+    DISPATCH();
+  }
+  // Going back round a loop
+  TARGET(JUMP) {
+    auto from = ip;
+    JUMP_TO(read_operand(ip));
+    if (ip < from) { RUN_NATIVE(); }
+    DISPATCH();
+  }
+  TARGET(JUMP_IF_FALSE) {
+    auto target = READ_OPERAND();
+    if (!isTruthy(sp[-1])) { JUMP_TO(target); }
+    DISPATCH();
+  }
+  TARGET(JUMP_IF_TRUE) {
+    auto target = READ_OPERAND();
+    if (isTruthy(sp[-1])) { JUMP_TO(target); }
+    DISPATCH();
+  }
+  TARGET(POP_JUMP_IF_FALSE) {
+    auto target = READ_OPERAND();
+    if (!isTruthy(*--sp)) { JUMP_TO(target); }
+    DISPATCH();
+  }
+  TARGET(FUNCTION) {
+    auto &proto = *chunk->functions[READ_OPERAND()];
+    *sp++       = Value(new CompiledFunction(proto));
+    SAFEPOINT();
+    DISPATCH();
+  }
+  TARGET(CALL) {
+    auto argc = READ_OPERAND();
+    auto &fn  = callee(sp, argc);
+    if (auto compiled = dynamic_cast<CompiledFunction *>(&fn)) {
+      auto &proto = compiled->proto();
+      if (!proto.compiled) { compile(proto); }
+      if (frames_.size() == max_frames) {
+        throw RuntimeError("Stack overflow");
+      }
+      // Parameters are the first variables, and are already in place
+      auto base = static_cast<size_t>(sp - argc - stack_.data());
+      auto &c   = proto.chunk;
+      reserve(base + c.frame_size + c.max_stack);
+      frame->ip = ip;
+      frame     = &frames_.emplace_back(Frame{&c, c.code.data(), base});
+      if (auto profiler = Profiler::running()) {
+        profiler->enter(proto.decl.name_.lexeme(), proto.decl.name_.line());
+      }
+      LOAD_FRAME();
+      // The rest of the variables start out nil rather than as whatever
+      // was left there, which the collector may have freed
+      std::fill(slots + argc, slots + c.frame_size, Value());
+      sp = slots + c.frame_size;
+      RUN_NATIVE();
+    } else {
+      sp = call_native(fn, sp, argc);
+    }
+    DISPATCH();
+  }
+  // The callee and its arguments take the place of the running frame's, and
+  // the callee runs there instead. A native callee is called as usual, to
+  // be returned from by the instructions that follow.
+  TARGET(TAIL_CALL) {
+    auto argc = READ_OPERAND();
+    auto &fn  = callee(sp, argc);
+    if (auto compiled = dynamic_cast<CompiledFunction *>(&fn)) {
+      auto &proto = compiled->proto();
+      if (!proto.compiled) { compile(proto); }
+      // Nothing left in the frame can fail, so its blocks are done with
+      auto running = frames_.size() - 1;
+      while (!handlers_.empty() && handlers_.back().frame == running) {
+        handlers_.pop_back();
+      }
+      std::copy(sp - argc - 1, sp, slots - 1);
+      auto &c = proto.chunk;
+      reserve(frame->base + c.frame_size + c.max_stack);
+      *frame = Frame{&c, c.code.data(), frame->base};
+      if (auto profiler = Profiler::running()) {
+        profiler->replace(proto.decl.name_.lexeme(), proto.decl.name_.line());
+      }
+      LOAD_FRAME();
+      std::fill(slots + argc, slots + c.frame_size, Value());
+      sp = slots + c.frame_size;
+      RUN_NATIVE();
+    } else {
+      sp = call_native(fn, sp, argc);
+    }
+    DISPATCH();
+  }
+  TARGET(TRY) {
+    auto target = READ_OPERAND();
+    handlers_.push_back(Handler{frames_.size() - 1,
+                                static_cast<size_t>(sp - stack_.data()),
+                                target});
+    DISPATCH();
+  }
+  TARGET(END_TRY) {
+    handlers_.pop_back();
+    DISPATCH();
+  }
+  // The result takes the place of the function that was called
+  TARGET(RETURN) {
+    auto result = *--sp;
+    frames_.pop_back();
+    if (frames_.empty()) {
+      top_ = static_cast<size_t>(sp - stack_.data());
+      return;
+    }
+    if (auto profiler = Profiler::running()) { profiler->leave(); }
+    sp    = slots - 1;
+    *sp++ = result;
+    frame = &frames_.back();
+    LOAD_FRAME();
+    RUN_NATIVE();
+    DISPATCH();
+  }
+
+#if !LOX_COMPUTED_GOTO
+    }
+  }
+#endif
+
+#undef LOAD_FRAME
+#undef READ_OPERAND
+#undef JUMP_TO
+#undef SAFEPOINT
+#undef RUN_NATIVE
+#undef ARITHMETIC
+#undef TARGET
+#undef DISPATCH
+}
+
+} // namespace lox
@@ -0,0 +1,117 @@
+#ifndef LOX_VM_HPP
+#define LOX_VM_HPP
+
+#include "Callable.hpp"
+#include "Chunk.hpp"
+#include "Environment.hpp"
+#include "Expr.hpp"
+#include "Heap.hpp"
+#if LOX_JIT
+#include "Jit.hpp"
+#endif
+#include "Stmt.hpp"
+#include "Value.hpp"
+
+#include <absl/strings/str_cat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lox {
+
+// A function made by running an Fn declaration in the VM
+class CompiledFunction : public Callable {
+  Proto &proto_;
+
+ public:
+  explicit CompiledFunction(Proto &proto)
+      : proto_(proto) {}
+
+  Proto &proto() { return proto_; }
+
+  // Only the VM can run these
+  Value operator()(Interpreter &, Args && = {}) override;
+
+  int arity() override { return proto_.decl.tokens_.size(); }
+  std::string to_string() override {
+    return absl::StrCat("<fn ", proto_.decl.name_.lexeme(), ">");
+  }
+};
+
+// Runs programs compiled to bytecode, as an alternative to the tree-walking
+// Interpreter that behaves exactly as it does: the same results, the same
+// output and the same errors, including the way a block or a function call
+// stops an error from going any further.
+//
+// There is one stack of values for the whole session. Each call's frame on it
+// is the function being called, then its variables (parameters first), then
+// whatever temporaries its expressions need. Frames only record where they
+// start and where they were up to; the instruction and stack pointers of the
+// running frame live in registers while it runs.
+//
+// The collector only runs straight after an instruction that allocates, once
+// top_ says how much of the stack is in use; that, and the globals, are the
+// VM's roots.
+//
+// Built with LOX_JIT, and asked to, the VM hands chunks it keeps coming back
+// to over to the Jit, and runs their machine code whenever it comes into one,
+// until that hands back an instruction it can't do itself.
+class VM : RootSource {
+  friend class Jit;
+
+  struct Frame {
+    const Chunk *chunk;
+    const uint8_t *ip;
+    // Index of the frame's first variable in stack_
+    size_t base;
+  };
+  // Where to carry on if anything in a block throws
+  struct Handler {
+    size_t frame;
+    size_t stack;
+    uint32_t target;
+  };
+
+  Globals globals_;
+  // Whether calls in tail position reuse the caller's frame
+  bool tail_calls_;
+  std::vector<std::unique_ptr<Proto>> protos_;
+  std::vector<Value> stack_;
+  std::vector<Frame> frames_;
+  std::vector<Handler> handlers_;
+  // The top of the stack whenever the running frame isn't in execute()
+  size_t top_ = 0;
+#if LOX_JIT
+  std::unique_ptr<Jit> jit_;
+#endif
+
+  void run();
+  // Runs the innermost frame, and any it calls, until the program ends
+  void execute();
+  // Finds somewhere to carry on after an error, or returns false if it
+  // escapes the program
+  bool unwind();
+  // Makes room for `size` values, which may move the stack
+  void reserve(size_t size);
+  void compile(Proto &);
+
+ public:
+  explicit VM(bool tail_calls = true, bool jit = false);
+  ~VM() override;
+  VM(const VM &)            = delete;
+  VM &operator=(const VM &) = delete;
+
+  void trace_roots(Heap &) override;
+
+  // Resolves and compiles the program, then runs it
+  void interpret(StatementsList);
+
+  Globals &globals() { return globals_; }
+};
+
+} // namespace lox
+
+#endif // LOX_VM_HPP
@@ -0,0 +1,98 @@
+#include "Value.hpp"
+
+#include <absl/container/flat_hash_set.h>
+#include <absl/hash/hash.h>
+
+#include <string>
+#include <utility>
+
+namespace lox {
+
+namespace {
+
+size_t hash_text(absl::string_view text) {
+  return absl::Hash<absl::string_view>{}(text);
+}
+
+// Looked up by text, and hashed with the hash each String keeps, so a String
+// is never hashed twice
+struct StringHash {
+  using is_transparent = void;
+  size_t operator()(const String *s) const { return s->hash(); }
+  size_t operator()(absl::string_view text) const { return hash_text(text); }
+};
+
+struct StringEq {
+  using is_transparent = void;
+  static absl::string_view text(const String *s) { return s->text(); }
+  static absl::string_view text(absl::string_view text) { return text; }
+  bool operator()(const auto &a, const auto &b) const {
+    return text(a) == text(b);
+  }
+};
+
+using StringTable = absl::flat_hash_set<String *, StringHash, StringEq>;
+
+// Never destroyed, like the Heap its Strings belong to
+StringTable &table() {
+  static auto *strings = new StringTable;
+  return *strings;
+}
+
+} // namespace
+
+String::~String() {
+  if (interned_) { table().erase(this); }
+}
+
+String *String::intern(absl::string_view text) {
+  auto &strings = table();
+  if (auto found = strings.find(text); found != strings.end()) {
+    return *found;
+  }
+  auto *s      = new String(std::string(text));
+  s->hash_     = hash_text(text);
+  s->hashed_   = true;
+  s->interned_ = true;
+  // Interned strings come from the program's text, which may use them again
+  // at any time
+  s->pin();
+  strings.insert(s);
+  return s;
+}
+
+size_t String::hash() const {
+  if (!hashed_) {
+    hash_   = hash_text(text());
+    hashed_ = true;
+  }
+  return hash_;
+}
+
+Value String::concat(const String &left, const String &right) {
+  auto &buffer = *left.buffer_;
+  if (left.interned_ || buffer.size() != left.size_) {
+    std::string text;
+    text.reserve(left.size_ + right.size_);
+    text.append(left.text()).append(right.text());
+    return Value(new String(std::move(text)));
+  }
+  // Appending may move the characters, which `right` might be part of
+  if (left.buffer_ == right.buffer_) {
+    buffer.append(std::string(right.text()));
+  } else {
+    buffer.append(right.text());
+  }
+  return Value(new String(left.buffer_, buffer.size(), right.size_));
+}
+
+bool String::equals(const String &other) const {
+  if (this == &other) { return true; }
+  // There's only one interned String with any given text
+  if (interned_ && other.interned_) { return false; }
+  if (size_ != other.size_) { return false; }
+  if (hashed_ && other.hashed_ && hash_ != other.hash_) { return false; }
+  return text() == other.text();
+}
+
+} // namespace lox
@@ -0,0 +1,167 @@
+#ifndef LOX_VALUE_HPP
+#define LOX_VALUE_HPP
+
+#include <absl/strings/string_view.h>
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace lox {
+
+class Callable;
+class Heap;
+class Jit;
+class Value;
+
+// Anything a Value refers to rather than holds. Every object belongs to the
+// Heap, which deletes it once the collector finds nothing refers to it.
+class Object {
+ public:
+  enum class Kind : uint8_t { String, Callable };
+
+ private:
+  // The rest of the Heap's objects
+  Object *next_   = nullptr;
+  uint32_t bytes_ = 0;
+  const Kind kind_;
+  bool marked_ = false;
+  bool pinned_ = false;
+
+  friend class Heap;
+
+ protected:
+  // Hands the object to the Heap, as taking up about `bytes`
+  Object(Kind kind, size_t bytes);
+
+ public:
+  virtual ~Object() = default;
+  Kind kind() const { return kind_; }
+  // Keeps the object around for good, for things that refer to it where the
+  // collector can't see, such as the AST
+  void pin() { pinned_ = true; }
+  // Marks every object this one refers to
+  virtual void trace(Heap &) const {}
+};
+
+// Strings never change once made. Those from the program's text are
+// interned, and pinned, as the AST refers to them.
+//
+// A String's text is the start of a buffer it may share. Concatenation
+// appends to the left operand's buffer, unless that is interned or has been
+// appended to since, and copies it only then.
+class String : public Object {
+  std::shared_ptr<std::string> buffer_;
+  size_t size_;
+  mutable size_t hash_ = 0;
+  mutable bool hashed_ = false;
+  bool interned_       = false;
+
+  // Only the characters it added to the buffer count towards its size
+  String(std::shared_ptr<std::string> buffer, size_t size, size_t added)
+      : Object(Kind::String, sizeof(String) + added)
+      , buffer_(std::move(buffer))
+      , size_(size) {}
+
+ public:
+  explicit String(std::string text)
+      : Object(Kind::String, sizeof(String) + text.size())
+      , buffer_(std::make_shared<std::string>(std::move(text)))
+      , size_(buffer_->size()) {}
+  ~String() override;
+
+  // The interned String with this text, which is made if there isn't one
+  static String *intern(absl::string_view text);
+  static Value concat(const String &left, const String &right);
+
+  absl::string_view text() const { return {buffer_->data(), size_}; }
+  size_t hash() const;
+  bool interned() const { return interned_; }
+  bool equals(const String &other) const;
+};
+
+// Asking a Value for something it doesn't hold
+class BadValueAccess : public std::exception {
+ public:
+  const char *what() const noexcept override { return "bad value access"; }
+};
+
+// A double, or else a quiet NaN with bits 50 and 51 set, which arithmetic
+// never makes: nil, a bool, or (with the sign bit) an Object pointer
+class Value {
+  static constexpr uint64_t quiet_nan  = 0x7ffc000000000000;
+  static constexpr uint64_t sign_bit   = 0x8000000000000000;
+  static constexpr uint64_t nil_bits   = quiet_nan | 1;
+  static constexpr uint64_t false_bits = quiet_nan | 2;
+  static constexpr uint64_t true_bits  = quiet_nan | 3;
+  static constexpr uint64_t object_tag = sign_bit | quiet_nan;
+
+  uint64_t bits_;
+
+  friend class Jit;
+
+  Object *object() const {
+    return reinterpret_cast<Object *>(bits_ & ~object_tag);
+  }
+
+ public:
+  Value()
+      : bits_(nil_bits) {}
+  Value(std::nullptr_t)
+      : bits_(nil_bits) {}
+  // Only an actual bool, so that pointers and the like don't turn into one
+  template <std::same_as<bool> B>
+  Value(B b)
+      : bits_(b ? true_bits : false_bits) {}
+  Value(double d) { std::memcpy(&bits_, &d, sizeof(d)); }
+  Value(std::string text)
+      : Value(new String(std::move(text))) {}
+  explicit Value(Object *obj)
+      : bits_(object_tag | reinterpret_cast<uintptr_t>(obj)) {}
+
+  bool is_nil() const { return bits_ == nil_bits; }
+  bool is_bool() const { return (bits_ | 1) == true_bits; }
+  bool is_number() const { return (bits_ & quiet_nan) != quiet_nan; }
+  bool is_object() const { return (bits_ & object_tag) == object_tag; }
+  bool is_string() const {
+    return is_object() && object()->kind() == Object::Kind::String;
+  }
+  bool is_callable() const {
+    return is_object() && object()->kind() == Object::Kind::Callable;
+  }
+
+  // Only for a Value known to hold the type asked for
+  bool as_bool() const { return bits_ == true_bits; }
+  double as_number() const {
+    double d;
+    std::memcpy(&d, &bits_, sizeof(d));
+    return d;
+  }
+  const String &as_string() const {
+    return *static_cast<String *>(object());
+  }
+  // Defined in Callable.hpp
+  Callable *as_callable() const;
+  Object *as_object() const { return object(); }
+
+  double number() const {
+    if (!is_number()) { throw BadValueAccess(); }
+    return as_number();
+  }
+
+  // Equal strings may still be different objects
+  bool same_bits(const Value &other) const { return bits_ == other.bits_; }
+};
+
+static_assert(sizeof(Value) == sizeof(uint64_t));
+static_assert(std::is_trivially_copyable_v<Value>);
+
+} // namespace lox
+
+#endif // LOX_VALUE_HPP
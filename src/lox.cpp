@@ -1,54 +1,133 @@
 #include "Error.hpp"
+#include "FlatAst.hpp"
+#include "Heap.hpp"
 #include "Interpreter.hpp"
+#include "Optimiser.hpp"
+#include "ParallelScanner.hpp"
 #include "Parser.hpp"
+#include "Profiler.hpp"
 #include "Scanner.hpp"
+#include "ScriptCache.hpp"
+#include "Source.hpp"
+#include "VM.hpp"
 
 #include <absl/strings/string_view.h>
 
 #include <fmt/core.h>
 
-// TODO: replace this?
-#include <filesystem>
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 
 #include <sysexits.h>
 
-std::error_code run(std::string &&);
+std::error_code run(lox::Source &&, bool cacheable);
 std::error_code run_file(absl::string_view, lox::Location &);
 std::error_code run_prompt(lox::Location &);
+void write_profile(const lox::Profiler &);
+
+// Switches that apply to everything run in this session
+struct Options {
+  bool lazy_functions = false;
+  bool optimise       = true;
+  bool cache          = true;
+  bool vm             = false;
+  bool gc_stats       = false;
+  bool tail_calls     = true;
+  bool jit            = false;
+  bool profile        = false;
+};
+
+struct Flag {
+  absl::string_view name;
+  bool Options::*value;
+  bool set_to;
+  absl::string_view help;
+};
+
+constexpr Flag flags[] = {
+    {"--lazy-functions", &Options::lazy_functions, true,
+     "only parse a function's body the first time it is called"},
+    {"--no-optimise", &Options::optimise, false,
+     "run the program exactly as parsed, without constant folding"},
+    {"--no-cache", &Options::cache, false,
+     "always parse scripts, never read or write compiled copies"},
+    {"--vm", &Options::vm, true,
+     "compile to bytecode and run that, instead of walking the tree"},
+    {"--gc-stats", &Options::gc_stats, true,
+     "print what the garbage collector did to stderr on exit"},
+    {"--no-tail-calls", &Options::tail_calls, false,
+     "give every call a frame of its own, even one in tail position"},
+    {"--profile", &Options::profile, true,
+     "sample which Lox functions are running, into $LOX_PROFILE_OUT"},
+#if LOX_JIT
+    {"--jit", &Options::jit, true,
+     "run the VM, compiling code it runs often to machine code"},
+#endif
+};
+
+Options options;
+
+int usage(absl::string_view self) {
+  fmt::print("Usage: {} [options] [file]\n", self);
+  for (auto &flag : flags) {
+    fmt::print("  {:<20} {}\n", flag.name, flag.help);
+  }
+  return EX_USAGE;
+}
 
 int main(int argc, char *argv[]) {
   // TODO: change to absl StatusOr?
   std::error_code err;
   lox::Location loc;
-  if (argc > 2) {
-    fmt::print("Usage: {} [file]\n", argv[0]);
-    return EX_USAGE;
-  } else if (argc == 2) {
-    err = run_file(argv[1], loc);
+  absl::string_view file;
+  for (int i = 1; i < argc; i++) {
+    absl::string_view arg = argv[i];
+    if (arg.starts_with("--")) {
+      auto flag = std::find_if(std::begin(flags), std::end(flags),
+                               [arg](auto &f) { return f.name == arg; });
+      if (flag == std::end(flags)) { return usage(argv[0]); }
+      options.*flag->value = flag->set_to;
+    } else if (file.empty()) {
+      file = arg;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  std::unique_ptr<lox::Profiler> profiler;
+  if (options.profile) {
+    profiler = std::make_unique<lox::Profiler>();
+    profiler->start();
+  }
+  if (!file.empty()) {
+    err = run_file(file, loc);
   } else {
     err = run_prompt(loc);
   }
+  if (profiler) {
+    profiler->stop();
+    write_profile(*profiler);
+  }
+  if (options.gc_stats) { lox::heap().print_stats(stderr); }
   if (err) {
-    lox::report_error("", loc);
+    lox::report_error(err.message(), loc);
     return EX_DATAERR;
   }
   return EX_OK;
 }
 
 std::error_code run_file(absl::string_view file_name, lox::Location &loc) {
-  std::error_code err;
   loc.where(file_name);
-  // file_size takes a string_view, but ifstream doesn't. Just use the
-  // string-terface
-  const auto path = std::string(file_name);
-  std::ifstream f(path, std::ios::in | std::ios::binary);
-  const size_t size = std::filesystem::file_size(path);
-  std::string src(size, '\0');
-  f.read(src.data(), size);
-  return run(std::move(src));
+  lox::Source src;
+  if (auto err = src.load(file_name)) { return err; }
+  return run(std::move(src), true);
 }
 
 std::error_code run_prompt(lox::Location &loc) {
@@ -57,19 +136,94 @@ std::error_code run_prompt(lox::Location &loc) {
     fmt::print("> ");
     std::getline(std::cin, line);
     if (line.empty()) { break; }
-    if (run(std::move(line))) {
+    if (run(lox::Source(std::move(line)), false)) {
       lox::report_error("Something blew up", lox::Location{});
     }
   } while (std::cin.good());
   return std::error_code{};
 }
 
-std::error_code run(std::string &&src) {
-  lox::Scanner scan(src);
-  auto tokens = scan.tokenise();
-  lox::Parser p(std::move(tokens));
-  auto tree = p.parse();
-  static lox::Interpreter interpreter;
-  interpreter.interpret(std::move(tree));
+// Everything one call to run() produced: the text and the AST parsed from it
+struct Unit {
+  lox::Source source;
+  lox::Arena arena;
+};
+
+lox::StatementsList parse(absl::string_view text, lox::Arena &arena) {
+  // Big scripts are worth tokenising up front across all cores; anything
+  // else streams straight from the scanner into the parser
+  lox::StatementsList tree;
+  if (text.length() >= lox::parallel_scan_threshold &&
+      std::thread::hardware_concurrency() > 1) {
+    auto tokens = lox::tokenise_parallel(text);
+    lox::TokenReader reader(tokens);
+    tree = lox::Parser(reader, arena, options.lazy_functions).parse();
+  } else {
+    lox::Scanner scan(text);
+    tree = lox::Parser(scan, arena, options.lazy_functions).parse();
+  }
+  if (options.optimise) { tree = lox::Optimiser(arena).optimise(tree); }
+  return tree;
+}
+
+// Looks the script up in the compiled-script cache, and parses it (adding
+// it to the cache) if it isn't there. Scripts with errors are never cached,
+// so the errors are reported on every run.
+//
+// Lowering a tree parses every function body in it, so with
+// --lazy-functions a script that isn't cached yet is only parsed, and left
+// for an eager run to store.
+lox::StatementsList parse_cached(absl::string_view text, lox::Arena &arena) {
+  auto cache = lox::ScriptCache::open_default();
+  if (!cache) { return parse(text, arena); }
+  // The optimiser changes the tree, so its trees are kept apart
+  uint32_t variant = options.optimise ? 1 : 0;
+  if (auto flat = cache->load(text, variant)) { return flat->inflate(arena); }
+  if (options.lazy_functions) { return parse(text, arena); }
+
+  auto errors = lox::error_count();
+  auto tree   = parse(text, arena);
+  auto flat   = lox::FlatAst::lower(tree);
+  if (lox::error_count() == errors) {
+    // Failing to write the cache (read-only home, full disk) isn't an error
+    // as far as running the script is concerned
+    (void)cache->store(text, variant, flat);
+  }
+  return tree;
+}
+
+std::error_code run(lox::Source &&src, bool cacheable) {
+  // The interpreter lives for the whole session, and whatever it has defined
+  // keeps pointing into the AST and the text it was parsed from. Hold on to
+  // every unit we have run until we exit.
+  static std::deque<Unit> units;
+  auto &unit = units.emplace_back(Unit{std::move(src), lox::Arena{}});
+  auto text  = unit.source.text();
+
+  auto tree = cacheable && options.cache ? parse_cached(text, unit.arena)
+                                         : parse(text, unit.arena);
+  if (options.vm || options.jit) {
+    static lox::VM vm(options.tail_calls, options.jit);
+    vm.interpret(tree);
+  } else {
+    static lox::Interpreter interpreter(options.tail_calls);
+    interpreter.interpret(tree);
+  }
   return std::error_code{};
 }
+
+// In collapsed format, to lox.folded unless $LOX_PROFILE_OUT says where
+void write_profile(const lox::Profiler &profiler) {
+  const char *path = std::getenv("LOX_PROFILE_OUT");
+  if (!path || !*path) { path = "lox.folded"; }
+  auto *out = std::fopen(path, "w");
+  if (!out) {
+    fmt::print(stderr, "profile: can't write {}: {}\n", path,
+               std::strerror(errno));
+    return;
+  }
+  auto samples = profiler.write(out);
+  std::fclose(out);
+  fmt::print(stderr, "profile: {} samples ({} dropped) written to {}\n",
+             samples, profiler.dropped(), path);
+}
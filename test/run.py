@@ -0,0 +1,55 @@
+#! /usr/bin/env python
+
+# Usage: run.py INTERPRETER SCRIPT [FLAG...]
+#
+# Runs SCRIPT and checks that it prints what its comments say it will. Each
+# `// expect: TEXT` is a line of output, and each `// expect error: MESSAGE`
+# a line reporting that error, in the order they appear in the script.
+
+from pathlib import Path
+
+import re
+import subprocess
+import sys
+
+
+def expectations(script):
+    ret = []
+    for line in Path(script).read_text().splitlines():
+        match = re.search(r'// expect( error)?: (.*)$', line)
+        if match:
+            ret.append((match.group(1) is not None, match.group(2)))
+    return ret
+
+
+def matches(expected, line):
+    is_error, text = expected
+    if is_error:
+        return line.startswith('Error {} in lox program'.format(text))
+    return line == text
+
+
+def main(interpreter, script, *flags):
+    run = subprocess.run([interpreter, '--no-cache', *flags, script],
+                         capture_output=True, text=True)
+    if run.returncode < 0:
+        print('{} died with signal {}'.format(script, -run.returncode))
+        return 1
+    got = run.stdout.splitlines()
+    want = expectations(script)
+    for i, (expected, line) in enumerate(zip(want, got)):
+        if not matches(expected, line):
+            print('line {}: expected "{}", got "{}"'.format(
+                i + 1, expected[1], line))
+            return 1
+    if len(got) != len(want):
+        print('expected {} lines of output, got {}'.format(len(want), len(got)))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        print('Usage: run.py INTERPRETER SCRIPT [FLAG...]')
+        sys.exit(64)
+    sys.exit(main(*sys.argv[1:]))
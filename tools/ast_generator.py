@@ -5,25 +5,10 @@ from pathlib import Path
 import sys
 
 
-# TODO: Improve this. It is so far the only class to be constructed differently
-# but I should still fix that in a more satisfying manner than special-casing
-def defineBlock(classname, fields):
-    ret = []
-    args = list(map(lambda x: x[1].rstrip('_'), fields))
-    ret.append(classname + '(' +
-               ', '.join(map(lambda x, y: x[0] + " &&" + y, fields, args)) + ')\n')
-    sep = ':'
-    for (field, arg) in zip(fields, args):
-        ret.append('{0}{1}(std::move({2}))\n'.format(sep, field[1], arg.rstrip('_')))
-        sep = ','
-    ret.append('{}\n')
-    return ret
-
-
 def defineConstructor(classname, fields):
-    if classname == "Block":
-        return defineBlock(classname, fields)
     ret = []
+    # Fields with an initialiser are filled in after parsing, not passed in
+    fields = [field for field in fields if len(field) == 2]
     args = list(map(lambda x: x[1].rstrip('_'), fields))
     ret.append(classname + '(' +
                ', '.join(map(lambda x, y: x[0] + " " + y, fields, args)) + ')\n')
@@ -45,13 +30,22 @@ def defineType(basename, classname, fields):
     ret = []
     ret.append('struct {0} : {1} {{\n'.format(classname, basename))
     for field in fields:
-        ret.append('{} {};\n'.format(*field))
+        if len(field) == 3:
+            ret.append('{} {} = {};\n'.format(*field))
+        else:
+            ret.append('{} {};\n'.format(*field))
     ret.extend(defineConstructor(classname, fields))
     return_type = 'void' if basename == 'Stmt' else 'ExprResult'
     ret.append('{0} accept({1}::Visitor<{0}>& v) override'.format(return_type, basename.lower()))
     ret.append('{{ return v.visit{}{}(*this); }}'.format(classname, basename))
     ret.append('std::string accept({0}::Visitor<std::string>& v) override'.format(basename.lower()))
     ret.append('{{ return v.visit{}{}(*this); }}'.format(classname, basename))
+    if basename == 'Stmt':
+        ret.append('Completion accept(stmt::Visitor<Completion>& v) override')
+        ret.append('{{ return v.visit{}{}(*this); }}'.format(classname, basename))
+    if basename == 'Expr':
+        ret.append('void accept(expr::Visitor<void>& v) override')
+        ret.append('{{ return v.visit{}{}(*this); }}'.format(classname, basename))
     ret.append('};\n\n')
     return ret
 
@@ -76,17 +70,35 @@ def defineAST(dir, basename, types):
         basename.upper()))
     if not basename == "Expr":
         lines.append('#include "Expr.hpp"\n')
-    lines.append('#include "Token.hpp"\n\n')
-    lines.append('#include <absl/container/inlined_vector.h>\n\n')
+    lines.append('#include "Token.hpp"\n')
+    if basename == "Expr":
+        lines.append('#include "Value.hpp"\n')
+    lines.append('\n')
+    lines.append('#include <absl/types/span.h>\n\n')
     lines.append('#include <cstddef>\n')
+    lines.append('#include <cstdint>\n')
     lines.append('#include <memory>\n')
     lines.append('#include <string>\n')
-    lines.append('#include <variant>\n\n')
+    lines.append('#include <type_traits>\n\n')
     lines.append('namespace lox {\n\n')
     if basename == "Expr":
-        lines.append('class Callable;\n')
-        lines.append('using CallablePtr = std::shared_ptr<Callable>;\n\n')
-        lines.append('using ExprResult = std::variant<bool, double, std::string, std::nullptr_t, CallablePtr>;\n\n')
+        # What evaluating an expression gives
+        lines.append('using ExprResult = Value;\n\n')
+        # Where a variable is found at run time, as worked out by the Resolver
+        lines.append('struct Binding {\n')
+        lines.append('static constexpr uint32_t global = UINT32_MAX - 1;\n')
+        lines.append('static constexpr uint32_t unresolved = UINT32_MAX;\n')
+        lines.append('uint32_t depth = unresolved;\n')
+        lines.append('uint32_t slot = 0;\n};\n\n')
+        # What a Binary node has made of the operands it has been given
+        lines.append('enum class Quickened : uint8_t {\n')
+        lines.append('Unseen, Generic, Add, Subtract, Multiply, Divide,\n')
+        lines.append('Greater, GreaterEqual, Less, LessEqual, Equal, NotEqual,\n};\n\n')
+        lines.append('enum class Operand : uint8_t { Evaluated, Local, Literal };\n\n')
+    if basename == "Stmt":
+        # How running a statement ended: normally, or by leaving a loop or
+        # function early, which whatever ran it has to pass on
+        lines.append('enum class Completion : uint8_t { Normal, Break, Continue, Return };\n\n')
     lines.append('namespace {} {{\n\n'.format(basename.lower()))
     lines.append('template <typename T> struct Visitor;\n\n')
     lines.append('}}  // namespace {}\n\n'.format(basename.lower()))
@@ -94,19 +106,29 @@ def defineAST(dir, basename, types):
         basename, return_type, basename.lower()))
     lines.append('virtual {0} accept({1}::Visitor<{0}>&) = 0;\n'.format(
         'std::string',  basename.lower()))
-    lines.append('virtual ~{}() = default;\n}};\n\n'.format(basename))
+    if basename == "Stmt":
+        lines.append('virtual Completion accept(stmt::Visitor<Completion>&) = 0;\n')
+    if basename == "Expr":
+        lines.append('virtual void accept(expr::Visitor<void>&) = 0;\n')
+    # Nodes live in an Arena and are never deleted through a base pointer, so
+    # the destructor stays non-virtual and every node trivially destructible
+    lines.append('\nprotected:\n~{}() = default;\n}};\n\n'.format(basename))
     for typ in iter(types):
         lines.extend(declareType(basename, typ))
     lines.append('\n')
     lines.extend(defineVisitor(basename, iter(types)))
-    lines.append('using {0}Ptr = std::shared_ptr<{0}>;'.format(basename))
+    # Owned by the Arena the parser allocated them in
+    lines.append('using {0}Ptr = {0} *;'.format(basename))
     if basename == "Stmt":
-        lines.append('using StatementsList = absl::InlinedVector<std::shared_ptr<lox::Stmt>, 8>;\n\n')
-        lines.append('using TokensList = absl::InlinedVector<Token, 8>;\n\n')
+        lines.append('using StatementsList = absl::Span<const StmtPtr>;\n\n')
+        lines.append('using TokensList = absl::Span<const Token>;\n\n')
+        lines.append('struct LazyBody;\n\n')
     if basename == "Expr":
-        lines.append('using ExpressionsList = absl::InlinedVector<std::shared_ptr<lox::Expr>, 8>;\n\n')
+        lines.append('using ExpressionsList = absl::Span<const ExprPtr>;\n\n')
     for typ in iter(types):
         lines.extend(defineType(basename, typ, types[typ]))
+    for typ in iter(types):
+        lines.append('static_assert(std::is_trivially_destructible_v<{}>);\n'.format(typ))
     lines.append('}}  // namespace lox\n#endif  // LOX_{}_HPP\n'.format(basename.upper()))
     path = Path(dir) / (basename + ".hpp")
     with open(path, 'w') as f:
@@ -121,26 +143,34 @@ def main():
         return 1
     out_dir = sys.argv[1]
     classes = {
-        "Assign"     : [("Token", "name_"), ("ExprPtr", "val_")],
-        "Binary"     : [("ExprPtr", "left_"), ("ExprPtr", "right_"), ("Token", "op_")],
+        "Assign"     : [("Token", "name_"), ("ExprPtr", "val_"), ("Binding", "binding_", "{}")],
+        "Binary"     : [("ExprPtr", "left_"), ("ExprPtr", "right_"), ("Token", "op_"),
+                        ("Quickened", "quickened_", "Quickened::Unseen"),
+                        ("Operand", "left_operand_", "Operand::Evaluated"),
+                        ("Operand", "right_operand_", "Operand::Evaluated")],
         "Ternary"    : [("ExprPtr", "cond_"), ("ExprPtr", "left_"), ("ExprPtr", "right_")],
-        "Call"       : [("ExprPtr", "callee_"), ("Token", "paren_"), ("ExpressionsList", "args_")],
+        "Call"       : [("ExprPtr", "callee_"), ("Token", "paren_"), ("ExpressionsList", "args_"),
+                        ("bool", "tail_", "false")],
         "Group"      : [("ExprPtr", "expr_")],
         "BoolLiteral": [("bool", "value_")],
-        "StrLiteral" : [("std::string", "value_")],
+        "StrLiteral" : [("absl::string_view", "value_"), ("String *", "interned_", "nullptr")],
         "NullLiteral": [],
         "NumLiteral" : [("double", "value_")],
         "Logical"    : [("ExprPtr", "left_"), ("ExprPtr", "right_"), ("Token", "op_")],
-        "Variable"   : [("Token", "name_")],
+        "Variable"   : [("Token", "name_"), ("Binding", "binding_", "{}")],
         "Unary"      : [("ExprPtr", "right_"), ("Token", "op_")]
     }
     stmt_classes = {
-        "Block"     : [("StatementsList", "statements_")],
+        "Block"     : [("StatementsList", "statements_"), ("uint32_t", "slots_", "0")],
         "Expression": [("ExprPtr", "expression_")],
-        "Fn"        : [("Token", "name_"), ("TokensList", "tokens_"), ("StatementsList", "statements_")],
+        "Fn"        : [("Token", "name_"), ("TokensList", "tokens_"), ("StatementsList", "statements_"),
+                       ("LazyBody *", "lazy_"), ("Binding", "binding_", "{}"), ("uint32_t", "slots_", "0")],
         "If"        : [("ExprPtr", "condition_"), ("StmtPtr", "then_"), ("StmtPtr", "else_br_")],
-        "While"     : [("ExprPtr", "condition_"), ("StmtPtr", "body_")],
-        "Var"       : [("Token", "name_"), ("ExprPtr", "initialiser_")],
+        "While"     : [("ExprPtr", "condition_"), ("StmtPtr", "body_"), ("ExprPtr", "increment_")],
+        "Var"       : [("Token", "name_"), ("ExprPtr", "initialiser_"), ("Binding", "binding_", "{}")],
+        "Return"    : [("ExprPtr", "value_")],
+        "Break"     : [],
+        "Continue"  : [],
     }
     defineAST(out_dir, "Expr", classes)
     defineAST(out_dir, "Stmt", stmt_classes)